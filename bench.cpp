@@ -0,0 +1,1326 @@
+/*************************************************************************/
+/*   Benchmarks for the mesh loading and simplification paths           */
+/*************************************************************************/
+
+#include <iostream>
+#include <iomanip>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include <cstdio>
+#include <new>
+#include <atomic>
+#include <sys/stat.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#include "mesh.h"
+#include "loader.h"
+#include "timer.h"
+#include "threadpool.h"
+#include "pairing.h"
+#include <boost/unordered_map.hpp>
+#include <boost/heap/binomial_heap.hpp>
+
+using namespace std;
+
+const int RUNS = 3;
+
+/* Every operator new made by the benchmark, for counting allocations */
+static atomic<size_t> heap_allocations(0);
+
+void*
+operator new(size_t n) {
+	heap_allocations.fetch_add(1, memory_order_relaxed);
+	void* p = malloc(n ? n : 1);
+	if (!p) throw bad_alloc();
+	return p;
+}
+
+void
+operator delete(void* p) noexcept {
+	free(p);
+}
+
+static double
+file_mb(const char* filename) {
+	struct stat st;
+	if (stat(filename, &st) != 0) return 0;
+	return st.st_size / (1024.0*1024.0);
+}
+
+/* File name of [path] without its directories, for the model column */
+static string
+model_name(const char* path) {
+	const char* base = strrchr(path, '/');
+	return base ? base+1 : path;
+}
+
+/* The footnote of the benchmarks that measure surface_error */
+const char* DISTANCE_NOTE = "distance from the input vertices to the result, per mille of the"
+	" bounding box diagonal";
+
+/* Wavy height field of about [numFaces] triangles */
+static void
+synthetic_grid(int numFaces, vector<vertex>& vertices, vector<vec3>& faces) {
+	int w = (int)ceil(sqrt(numFaces/2.0)) + 1;
+	vertices.clear();
+	faces.clear();
+	vertices.reserve(w*w);
+	faces.reserve(2*(w-1)*(w-1));
+	for (int y=0; y<w; y+=1) {
+		for (int x=0; x<w; x+=1) {
+			vertices.push_back(vertex(x, y, sin(x*0.05)*cos(y*0.07)*10));
+		}
+	}
+	for (int y=0; y+1<w; y+=1) {
+		for (int x=0; x+1<w; x+=1) {
+			int v = y*w + x;
+			faces.push_back(vec3(v, v+1, v+w));
+			faces.push_back(vec3(v+1, v+w+1, v+w));
+		}
+	}
+}
+
+/* Loads the model named by argv[f] into [vertices] and [faces], or a
+ * synthetic grid of the given number of faces for "-synthetic N", which
+ * also steps [f] over the count */
+static bool
+load_bench_model(int argc, char* argv[], int& f, vector<vertex>& vertices, vector<vec3>& faces,
+				 string& name) {
+	if (!strcmp(argv[f], "-synthetic") && f+1 < argc) {
+		synthetic_grid(atoi(argv[++f]), vertices, faces);
+		name = "synthetic";
+		return true;
+	}
+	name = model_name(argv[f]);
+	return readMeshFile(argv[f], vertices, faces);
+}
+
+/* Compares the mapped reader against the getline+stringstream reader */
+static void
+bench_load(int argc, char* argv[]) {
+	cout << setw(24) << left << "model" << right
+		 << setw(10) << "MB"
+		 << setw(12) << "stream ms"
+		 << setw(12) << "mmap ms"
+		 << setw(10) << "speedup"
+		 << setw(12) << "max diff" << endl;
+	for (int f=0; f<argc; f+=1) {
+		vector<vertex> v0, v1;
+		vector<vec3> f0, f1;
+		double tstream = 1e30, tmmap = 1e30;
+		for (int r=0; r<RUNS; r+=1) {
+			double t = wall_time();
+			if (!readOFFStream(argv[f], v0, f0)) break;
+			tstream = min(tstream, wall_time()-t);
+			t = wall_time();
+			if (!readOFF(argv[f], v1, f1)) break;
+			tmmap = min(tmmap, wall_time()-t);
+		}
+		if (v0.size() != v1.size() || f0.size() != f1.size()) {
+			cout << argv[f] << ": readers disagree on the element counts" << endl;
+			continue;
+		}
+		float diff = 0;
+		for (int i=0; i<v0.size(); i+=1) {
+			vec3 d = glm::abs(v0[i].position - v1[i].position);
+			diff = max(diff, max(d.x, max(d.y, d.z)));
+		}
+		for (int i=0; i<f0.size(); i+=1) {
+			if (f0[i] != f1[i]) {
+				cout << argv[f] << ": face " << i << " differs" << endl;
+				break;
+			}
+		}
+		cout << setw(24) << left << model_name(argv[f]) << right << fixed
+			 << setw(10) << setprecision(2) << file_mb(argv[f])
+			 << setw(12) << setprecision(2) << tstream*1000
+			 << setw(12) << setprecision(2) << tmmap*1000
+			 << setw(9) << setprecision(1) << tstream/tmmap << "x"
+			 << setw(12) << scientific << setprecision(1) << diff << endl;
+	}
+}
+
+/* Parse throughput of the chunked reader at increasing thread counts */
+static void
+bench_parse(int argc, char* argv[]) {
+	const int THREADS[] = {1, 2, 4, 8, 16};
+	const int NUM_THREADS = sizeof(THREADS)/sizeof(THREADS[0]);
+	cout << setw(24) << left << "model (MB/s)" << right;
+	for (int t=0; t<NUM_THREADS; t+=1) {
+		cout << setw(8) << THREADS[t] << "T";
+	}
+	cout << endl;
+	for (int f=0; f<argc; f+=1) {
+		vector<vertex> serialv, v;
+		vector<vec3> serialf, faces;
+		if (!readOFF(argv[f], serialv, serialf)) continue;
+		cout << setw(24) << left << model_name(argv[f]) << right << fixed << setprecision(1);
+		for (int t=0; t<NUM_THREADS; t+=1) {
+			double best = 0;
+			for (int r=0; r<RUNS; r+=1) {
+				load_stats stats;
+				readOFF(argv[f], v, faces, THREADS[t], &stats);
+				best = max(best, stats.megabytes_per_second());
+			}
+			bool same = v.size() == serialv.size() && faces == serialf;
+			for (int i=0; same && i<v.size(); i+=1) {
+				same = v[i].position == serialv[i].position;
+			}
+			cout << setw(8) << best << (same ? " " : "!");
+		}
+		cout << endl;
+	}
+	cout << "(" << hardware_threads() << " hardware threads; '!' marks output that differs from the serial reader)" << endl;
+}
+
+/* Full parse and preparation against reloading the binary cache */
+static void
+bench_cache(int argc, char* argv[]) {
+	cout << setw(24) << left << "model" << right
+		 << setw(12) << "parse ms"
+		 << setw(12) << "cache ms"
+		 << setw(10) << "speedup" << endl;
+	for (int f=0; f<argc; f+=1) {
+		vector<vertex> v0, v1;
+		vector<vec3> f0, f1;
+		double tparse = 1e30, tcache = 1e30;
+		for (int r=0; r<RUNS; r+=1) {
+			double t = wall_time();
+			if (!loadMesh(argv[f], v0, f0, 1, false)) break;
+			tparse = min(tparse, wall_time()-t);
+		}
+		if (!writeCache(argv[f], v0, f0)) continue;
+		for (int r=0; r<RUNS; r+=1) {
+			double t = wall_time();
+			if (!readCache(argv[f], v1, f1)) break;
+			tcache = min(tcache, wall_time()-t);
+		}
+		remove(cacheFilename(argv[f]).c_str());
+		bool same = v0.size() == v1.size() && f0 == f1;
+		for (int i=0; same && i<v0.size(); i+=1) {
+			same = v0[i].position == v1[i].position && v0[i].normal == v1[i].normal &&
+				!memcmp(v0[i].Q.q, v1[i].Q.q, sizeof(v0[i].Q.q));
+		}
+		cout << setw(24) << left << model_name(argv[f]) << right << fixed
+			 << setw(12) << setprecision(2) << tparse*1000
+			 << setw(12) << setprecision(2) << tcache*1000
+			 << setw(9) << setprecision(1) << tparse/tcache << "x"
+			 << (same ? "" : "  (cache differs!)") << endl;
+	}
+}
+
+/* The original preparation: a normal pass, a rescale pass and a
+ * separate quadric pass, each scattering faces serially */
+static void
+prepare_reference(vector<vertex>& vertices, vector<vec3>& faces) {
+	vec3 lo(999999), hi(-999999);
+	for (int i=0; i<vertices.size(); i+=1) {
+		lo = glm::min(lo, vertices[i].position);
+		hi = glm::max(hi, vertices[i].position);
+	}
+	vec3 middle = (hi+lo)/2.0f;
+	float ratio = 8.0/max(max(hi.x-lo.x, hi.y-lo.y), hi.z-lo.z);
+	for (int i=0; i<faces.size(); i+=1) {
+		vertex& a = vertices[(int)faces[i][0]];
+		vertex& b = vertices[(int)faces[i][1]];
+		vertex& c = vertices[(int)faces[i][2]];
+		vec3 norm = glm::cross(b.position-a.position, c.position-a.position);
+		a.normal += norm;
+		b.normal += norm;
+		c.normal += norm;
+	}
+	for (int i=0; i<vertices.size(); i+=1) {
+		vertices[i].normal = glm::normalize(vertices[i].normal);
+		vertices[i].position = (vertices[i].position - middle) * ratio;
+	}
+	for (int i=0; i<faces.size(); i+=1) {
+		vertex* v[3];
+		for (int k=0; k<3; k+=1) v[k] = &vertices[(int)faces[i][k]];
+		vec3 norm = glm::normalize(glm::cross(v[1]->position-v[0]->position, v[2]->position-v[0]->position));
+		vec4 p = vec4(norm, -glm::dot(norm, v[0]->position));
+		int index = 0;
+		for (int y=0; y<4; y+=1) {
+			for (int x=y; x<4; x+=1) {
+				for (int k=0; k<3; k+=1) v[k]->Q[index] += p[x]*p[y];
+				index += 1;
+			}
+		}
+	}
+}
+
+/* Normal and quadric setup: the old serial passes against the fused
+ * parallel pass at increasing thread counts */
+static void
+bench_prepare(int argc, char* argv[]) {
+	const int THREADS[] = {1, 2, 4, 8, 16};
+	const int NUM_THREADS = sizeof(THREADS)/sizeof(THREADS[0]);
+	cout << setw(24) << left << "model (ms)" << right << setw(9) << "old";
+	for (int t=0; t<NUM_THREADS; t+=1) {
+		cout << setw(8) << THREADS[t] << "T";
+	}
+	cout << setw(12) << "max diff" << endl;
+	for (int f=0; f<argc; f+=1) {
+		vector<vertex> raw, v, serial;
+		vector<vec3> faces;
+		string name;
+		if (!load_bench_model(argc, argv, f, raw, faces, name)) continue;
+		double told = 1e30;
+		for (int r=0; r<RUNS; r+=1) {
+			v = raw;
+			double t = wall_time();
+			prepare_reference(v, faces);
+			told = min(told, wall_time()-t);
+		}
+		vector<vertex> reference = v;
+		cout << setw(24) << left << name << right << fixed << setprecision(2)
+			 << setw(9) << told*1000;
+		for (int t=0; t<NUM_THREADS; t+=1) {
+			double best = 1e30;
+			for (int r=0; r<RUNS; r+=1) {
+				v = raw;
+				double start = wall_time();
+				prepareMesh(v, faces, THREADS[t]);
+				best = min(best, wall_time()-start);
+			}
+			if (t == 0) serial = v;
+			bool same = true;
+			for (int i=0; same && i<v.size(); i+=1) {
+				same = v[i].position == serial[i].position && v[i].normal == serial[i].normal &&
+					!memcmp(v[i].Q.q, serial[i].Q.q, sizeof(v[i].Q.q));
+			}
+			cout << setw(8) << best*1000 << (same ? " " : "!");
+		}
+		float diff = 0;
+		for (int i=0; i<v.size(); i+=1) {
+			vec3 d = glm::abs(v[i].normal - reference[i].normal);
+			diff = max(diff, max(d.x, max(d.y, d.z)));
+		}
+		cout << setw(12) << scientific << setprecision(1) << diff << endl;
+	}
+	cout << "(" << hardware_threads() << " hardware threads; '!' marks results that differ from 1 thread)" << endl;
+}
+
+/* Writes [vertices]/[faces] as binary little endian PLY */
+static bool
+write_ply(const char* filename, const vector<vertex>& vertices, const vector<vec3>& faces) {
+	FILE* out = fopen(filename, "wb");
+	if (!out) return false;
+	fprintf(out, "ply\nformat binary_little_endian 1.0\n"
+				 "element vertex %d\nproperty float x\nproperty float y\nproperty float z\n"
+				 "element face %d\nproperty list uchar int vertex_indices\nend_header\n",
+				 (int)vertices.size(), (int)faces.size());
+	for (int i=0; i<vertices.size(); i+=1) {
+		fwrite(&vertices[i].position[0], sizeof(float), 3, out);
+	}
+	for (int i=0; i<faces.size(); i+=1) {
+		unsigned char n = 3;
+		int ids[3] = {(int)faces[i][0], (int)faces[i][1], (int)faces[i][2]};
+		fwrite(&n, 1, 1, out);
+		fwrite(ids, sizeof(int), 3, out);
+	}
+	return fclose(out) == 0;
+}
+
+/* OFF text parsing against binary PLY holding the same mesh */
+static void
+bench_ply(int argc, char* argv[]) {
+	const char* tmp = "/tmp/bench_mesh.ply";
+	cout << setw(24) << left << "model" << right
+		 << setw(12) << "OFF ms"
+		 << setw(12) << "PLY ms"
+		 << setw(10) << "speedup" << endl;
+	for (int f=0; f<argc; f+=1) {
+		vector<vertex> v0, v1;
+		vector<vec3> f0, f1;
+		if (!readOFF(argv[f], v0, f0) || !write_ply(tmp, v0, f0)) continue;
+		double toff = 1e30, tply = 1e30;
+		for (int r=0; r<RUNS; r+=1) {
+			double t = wall_time();
+			readOFF(argv[f], v0, f0);
+			toff = min(toff, wall_time()-t);
+			t = wall_time();
+			if (!readPLY(tmp, v1, f1)) break;
+			tply = min(tply, wall_time()-t);
+		}
+		bool same = v0.size() == v1.size() && f0 == f1;
+		for (int i=0; same && i<v0.size(); i+=1) {
+			same = v0[i].position == v1[i].position;
+		}
+		cout << setw(24) << left << model_name(argv[f]) << right << fixed
+			 << setw(12) << setprecision(2) << toff*1000
+			 << setw(12) << setprecision(2) << tply*1000
+			 << setw(9) << setprecision(1) << toff/tply << "x"
+			 << (same ? "" : "  (PLY differs!)") << endl;
+	}
+	remove(tmp);
+}
+
+/* Compresses [source] into [dest]; .zst needs zstd, anything else is gzip */
+static bool
+compress_file(const char* source, const char* dest) {
+	mapped_file in;
+	if (!in.open(source)) return false;
+	size_t n = strlen(dest);
+	if (n >= 4 && !strcmp(dest+n-4, ".zst")) {
+#ifdef HAVE_ZSTD
+		vector<char> out(ZSTD_compressBound(in.size));
+		size_t size = ZSTD_compress(&out[0], out.size(), in.data, in.size, 3);
+		FILE* f = fopen(dest, "wb");
+		if (!f || ZSTD_isError(size)) return false;
+		bool ok = fwrite(&out[0], 1, size, f) == size;
+		return (fclose(f) == 0) && ok;
+#else
+		return false;
+#endif
+	}
+	gzFile f = gzopen(dest, "wb6");
+	if (!f) return false;
+	bool ok = gzwrite(f, in.data, in.size) == (int)in.size;
+	return (gzclose(f) == Z_OK) && ok;
+}
+
+/* Plain mapped parsing against decoding a compressed copy while parsing */
+static void
+bench_compressed(int argc, char* argv[]) {
+	const char* FORMATS[] = {".gz", ".zst"};
+	cout << setw(24) << left << "model" << right
+		 << setw(8) << "format"
+		 << setw(10) << "ratio"
+		 << setw(12) << "plain ms"
+		 << setw(12) << "total ms"
+		 << setw(12) << "inflate ms"
+		 << setw(12) << "parse ms" << endl;
+	for (int f=0; f<argc; f+=1) {
+		vector<vertex> v0, v1;
+		vector<vec3> f0, f1;
+		double tplain = 1e30;
+		for (int r=0; r<RUNS; r+=1) {
+			double t = wall_time();
+			if (!readOFF(argv[f], v0, f0)) break;
+			tplain = min(tplain, wall_time()-t);
+		}
+		string name = model_name(argv[f]);
+		for (int k=0; k<2; k+=1) {
+			string tmp = string("/tmp/bench_mesh.off") + FORMATS[k];
+			if (!compress_file(argv[f], tmp.c_str())) continue;
+			double ttotal = 1e30;
+			load_stats best;
+			for (int r=0; r<RUNS; r+=1) {
+				load_stats stats;
+				double t = wall_time();
+				if (!readMeshFile(tmp.c_str(), v1, f1, 1, &stats)) break;
+				if (wall_time()-t < ttotal) {
+					ttotal = wall_time()-t;
+					best = stats;
+				}
+			}
+			remove(tmp.c_str());
+			bool same = v0.size() == v1.size() && f0 == f1;
+			for (int i=0; same && i<v0.size(); i+=1) {
+				same = v0[i].position == v1[i].position;
+			}
+			cout << setw(24) << left << name << right << fixed
+				 << setw(8) << FORMATS[k]
+				 << setw(10) << setprecision(2) << (double)best.bytes/max<size_t>(best.compressed_bytes, 1)
+				 << setw(12) << setprecision(2) << tplain*1000
+				 << setw(12) << setprecision(2) << ttotal*1000
+				 << setw(12) << setprecision(2) << best.decompress_seconds*1000
+				 << setw(12) << setprecision(2) << best.parse_seconds*1000
+				 << (same ? "" : "  (output differs!)") << endl;
+		}
+	}
+}
+
+/* The pairing Mesh used to do: every half-edge looked up in a hash map
+ * of undirected edges, one at a time */
+static void
+pair_with_map(const vector<vec3>& faces, vector<int>& sym, vector<int>& owner) {
+	boost::unordered_map< pair<int, int>, int > existing;
+	int n = 3*faces.size();
+	sym.assign(n, -1);
+	owner.resize(n);
+	for (int i=0; i<n; i+=1) {
+		int v0 = faces[i/3][i%3];
+		int v1 = faces[i/3][(i+1)%3];
+		pair<int, int> key(min(v0, v1), max(v0, v1));
+		boost::unordered_map< pair<int, int>, int >::iterator it = existing.find(key);
+		if (it != existing.end()) {
+			sym[i] = it->second;
+			sym[it->second] = i;
+			owner[i] = it->second;
+		} else {
+			existing[key] = i;
+			owner[i] = i;
+		}
+	}
+}
+
+/* Half-edge pairing: the old hash map against the radix sort at
+ * increasing thread counts, then the whole Mesh construction */
+static void
+bench_build(int argc, char* argv[]) {
+	const int THREADS[] = {1, 2, 4, 8, 16};
+	const int NUM_THREADS = sizeof(THREADS)/sizeof(THREADS[0]);
+	cout << setw(24) << left << "model (ms)" << right << setw(10) << "faces" << setw(9) << "map";
+	for (int t=0; t<NUM_THREADS; t+=1) {
+		cout << setw(8) << THREADS[t] << "T";
+	}
+	cout << setw(10) << "mesh" << endl;
+	for (int f=0; f<argc; f+=1) {
+		vector<vertex> v;
+		vector<vec3> faces;
+		string name;
+		if (!load_bench_model(argc, argv, f, v, faces, name)) continue;
+		prepareMesh(v, faces);
+
+		vector<int> mapSym, mapOwner, sym, owner;
+		double tmap = 1e30;
+		for (int r=0; r<RUNS; r+=1) {
+			double t = wall_time();
+			pair_with_map(faces, mapSym, mapOwner);
+			tmap = min(tmap, wall_time()-t);
+		}
+		cout << setw(24) << left << name << right << setw(10) << faces.size()
+			 << fixed << setprecision(1) << setw(9) << tmap*1000;
+		for (int t=0; t<NUM_THREADS; t+=1) {
+			double best = 1e30;
+			for (int r=0; r<RUNS; r+=1) {
+				double start = wall_time();
+				pairHalfEdges(faces, sym, owner, THREADS[t]);
+				best = min(best, wall_time()-start);
+			}
+			bool same = sym == mapSym && owner == mapOwner;
+			cout << setw(8) << best*1000 << (same ? " " : "!");
+		}
+		vector<int>().swap(mapSym);
+		vector<int>().swap(mapOwner);
+		double t = wall_time();
+		Mesh* mesh = new Mesh(v, faces, hardware_threads());
+		cout << setw(10) << (wall_time()-t)*1000 << endl;
+		delete mesh;
+	}
+	cout << "(" << hardware_threads() << " hardware threads; '!' marks pairings that differ from the map)" << endl;
+}
+
+/* The cost setup of Mesh construction: every edge evaluated one at a
+ * time with calculate_quad_error, against calculate_quad_errors solving
+ * a vector register of edges per instruction stream */
+static void
+bench_costs(int argc, char* argv[]) {
+	cout << setw(24) << left << "model" << right << setw(10) << "edges"
+		 << setw(12) << "single ms" << setw(11) << "batch ms" << setw(10) << "speedup"
+		 << setw(12) << "ns/edge" << endl;
+	for (int f=0; f<argc; f+=1) {
+		vector<vertex> v;
+		vector<vec3> faces;
+		string name;
+		if (!load_bench_model(argc, argv, f, v, faces, name)) continue;
+		prepareMesh(v, faces, hardware_threads());
+		Mesh* mesh = new Mesh(v, faces, hardware_threads());
+		vector<vertex>().swap(v);
+		vector<vec3>().swap(faces);
+
+		int n = mesh->merge_costs.size();
+		vector<int> ids(n);
+		for (int e=0; e<n; e+=1) {
+			ids[e] = e;
+		}
+		vector<float> single;
+		double tsingle = 1e30, tbatch = 1e30;
+		bool same = true;
+		for (int r=0; r<RUNS; r+=1) {
+			double t = wall_time();
+			for (int e=0; e<n; e+=1) {
+				mesh->calculate_quad_error(e);
+			}
+			tsingle = min(tsingle, wall_time()-t);
+			single = mesh->merge_costs;
+
+			t = wall_time();
+			mesh->calculate_quad_errors(&ids[0], n);
+			tbatch = min(tbatch, wall_time()-t);
+			same = same && !memcmp(&single[0], &mesh->merge_costs[0], n*sizeof(float));
+		}
+		delete mesh;
+		cout << setw(24) << left << name << right << setw(10) << n
+			 << fixed << setprecision(1) << setw(12) << tsingle*1000
+			 << setw(10) << tbatch*1000 << (same ? " " : "!")
+			 << setprecision(2) << setw(9) << tsingle/tbatch << "x"
+			 << setprecision(1) << setw(12) << tbatch*1e9/max(n, 1) << endl;
+	}
+	cout << "(" << quadric_batch::LANES << " lanes per batch; '!' marks costs that differ from one at a time)" << endl;
+}
+
+/* The half-edge layout before edges moved into one array: a heap node
+ * per half-edge, reached through a table of pointers */
+struct pointer_half_edge {
+	int v;
+	pointer_half_edge *next, *prev, *sym;
+	void* data;
+	int index;
+};
+
+/* Adjacency memory against the pointer layout, then the time and heap
+ * allocations to build each mesh, bring it down to a tenth of its faces
+ * and free it */
+static void
+bench_collapse(int argc, char* argv[]) {
+	cout << setw(24) << left << "model" << right << setw(10) << "faces"
+		 << setw(12) << "old MB" << setw(10) << "new MB" << setw(10) << "build"
+		 << setw(12) << "simplify" << setw(10) << "free" << setw(12) << "us/face"
+		 << setw(10) << "allocs" << setw(10) << "cost ns" << endl;
+	for (int f=0; f<argc; f+=1) {
+		vector<vertex> v;
+		vector<vec3> faces;
+		string name;
+		if (!load_bench_model(argc, argv, f, v, faces, name)) continue;
+		prepareMesh(v, faces);
+
+		/* malloc rounds each node up to a 16 byte multiple plus a header */
+		size_t oldBytes = faces.size()*3*(sizeof(pointer_half_edge*) + (sizeof(pointer_half_edge)+8+15)/16*16);
+		size_t newBytes = 0, allocs = 0;
+		double build = 1e30, best = 1e30, release = 1e30, eval = 1e30;
+		int removed = 0;
+		for (int r=0; r<RUNS; r+=1) {
+			size_t before = heap_allocations;
+			double start = wall_time();
+			Mesh* mesh = new Mesh(v, faces);
+			double built = wall_time();
+			newBytes = mesh->edges.capacity()*sizeof(half_edge) + mesh->removed.capacity();
+			int n = mesh->face_count();
+			mesh->simplify((int)ceil(n*0.1));
+			double simplified = wall_time();
+			removed = n - mesh->face_count();
+			allocs = heap_allocations - before;
+
+			/* One more cost evaluation of every edge left; the queue is
+			 * not reordered, so this must come last */
+			int live = 0;
+			double t = wall_time();
+			for (int e=0; e<mesh->retired.size(); e+=1) {
+				if (mesh->retired[e]) continue;
+				mesh->calculate_quad_error(e);
+				live += 1;
+			}
+			double swept = wall_time();
+			eval = min(eval, (swept-t)/max(live, 1));
+			delete mesh;
+			build = min(build, built-start);
+			best = min(best, simplified-built);
+			release = min(release, wall_time()-swept);
+		}
+		cout << setw(24) << left << name << right << setw(10) << faces.size()
+			 << fixed << setprecision(1) << setw(12) << oldBytes/1048576.0
+			 << setw(10) << newBytes/1048576.0 << setw(10) << build*1000
+			 << setw(12) << best*1000 << setw(10) << release*1000
+			 << setprecision(2) << setw(12) << best*1e6/max(removed, 1)
+			 << setw(10) << allocs << setprecision(1) << setw(10) << eval*1e9 << endl;
+	}
+	cout << "(half-edge: " << sizeof(pointer_half_edge) << " bytes as a heap node, "
+		 << sizeof(half_edge) << " bytes in the array)" << endl;
+}
+
+/* The cost evaluation as it was written before the quadric type: ten
+ * float adds, Cramer's rule and the expanded polynomial */
+static float
+reference_cost(const float* Q1, const float* Q2, const vec3& mid) {
+	float Q[10];
+	for (int k=0; k<10; k+=1) Q[k] = Q1[k] + Q2[k];
+	float a = Q[0], b = Q[1], c = Q[2], d = Q[3], e = Q[4];
+	float f = Q[5], g = Q[6], h = Q[7], i = Q[8];
+	float det = a*e*h - a*f*f - b*b*h + 2*b*c*f - c*c*e;
+	float x = mid.x, y = mid.y, z = mid.z;
+	if (det >= 0.01) {
+		x = (d*f*f - c*g*f - b*i*f - d*e*h + b*g*h + c*e*i)/det;
+		y = (g*c*c - d*f*c - b*i*c + b*d*h - a*g*h + a*f*i)/det;
+		z = (i*b*b - d*f*b - c*g*b + c*d*e + a*f*g - a*e*i)/det;
+	}
+	return a*x*x + 2*b*x*y + 2*c*x*z + 2*d*x + e*y*y
+		+ 2*f*y*z + 2*g*y + h*z*z + 2*i*z + Q[9];
+}
+
+static float
+scalar_cost(const quadric& Q1, const quadric& Q2, const vec3& mid) {
+	quadric Q = Q1;
+	Q.add_scalar(Q2);
+	vec3 p;
+	float det = Q.solve_scalar(p);
+	return Q.evaluate_scalar(det >= 0.01 ? p : mid);
+}
+
+static float
+kernel_cost(const quadric& Q1, const quadric& Q2, const vec3& mid) {
+	quadric Q = Q1 + Q2;
+	vec3 p;
+	float det = Q.solve(p);
+	return Q.evaluate(det >= 0.01 ? p : mid);
+}
+
+/* Edge cost evaluations per second (sum the two end quadrics, solve for
+ * the best point, evaluate there) with the old expanded formulas, the
+ * scalar quadric kernels, the SSE ones and a quadric_batch, over every
+ * edge of each mesh */
+static void
+bench_quadric(int argc, char* argv[]) {
+	cout << setw(24) << left << "model (M evals/s)" << right << setw(10) << "edges"
+		 << setw(10) << "old" << setw(10) << "scalar" << setw(10) << "sse"
+		 << setw(10) << "batch" << setw(12) << "max diff" << endl;
+	for (int f=0; f<argc; f+=1) {
+		vector<vertex> v;
+		vector<vec3> faces;
+		string name;
+		if (!load_bench_model(argc, argv, f, v, faces, name)) continue;
+		prepareMesh(v, faces);
+
+		vector<pair<int,int> > pairs;
+		for (int i=0; i<faces.size(); i+=1) {
+			for (int k=0; k<3; k+=1) {
+				int a = faces[i][k], b = faces[i][(k+1)%3];
+				if (a < b) pairs.push_back(make_pair(a, b));
+			}
+		}
+		vector<vec3> mids(pairs.size());
+		for (int i=0; i<pairs.size(); i+=1) {
+			mids[i] = (v[pairs[i].first].position + v[pairs[i].second].position)/2.0f;
+		}
+		int reps = max(1, 4000000/max((int)pairs.size(), 1));
+		double best[4] = { 1e30, 1e30, 1e30, 1e30 };
+		float sink = 0, diff = 0;
+		quadric_batch batch;
+		for (int r=0; r<RUNS; r+=1) {
+			for (int kind=0; kind<4; kind+=1) {
+#ifndef QUADRIC_SSE
+				if (kind == 2) continue;
+#endif
+				double start = wall_time();
+				for (int n=0; kind == 3 && n<reps; n+=1) {
+					for (int i=0; i<pairs.size(); i+=QUADRIC_BATCH) {
+						int count = min((int)pairs.size()-i, QUADRIC_BATCH);
+						for (int k=0; k<count; k+=1) {
+							batch.set(k, v[pairs[i+k].first].Q, v[pairs[i+k].second].Q, mids[i+k], true);
+						}
+						batch.evaluate(count);
+						for (int k=0; k<count; k+=1) sink += batch.cost[k];
+					}
+				}
+				for (int n=0; kind < 3 && n<reps; n+=1) {
+					for (int i=0; i<pairs.size(); i+=1) {
+						const vertex& a = v[pairs[i].first];
+						const vertex& b = v[pairs[i].second];
+						float cost;
+						if (kind == 0) cost = reference_cost(a.Q.q, b.Q.q, mids[i]);
+						else if (kind == 1) cost = scalar_cost(a.Q, b.Q, mids[i]);
+						else cost = kernel_cost(a.Q, b.Q, mids[i]);
+						sink += cost;
+					}
+				}
+				best[kind] = min(best[kind], (wall_time()-start)/reps);
+			}
+		}
+		for (int i=0; i<pairs.size(); i+=1) {
+			const vertex& a = v[pairs[i].first];
+			const vertex& b = v[pairs[i].second];
+			float old = reference_cost(a.Q.q, b.Q.q, mids[i]);
+			float now = kernel_cost(a.Q, b.Q, mids[i]);
+			float scale = max(fabsf(old), fabsf(a.Q[9] + b.Q[9]));
+			diff = max(diff, fabsf(now-old)/max(scale, 1e-6f));
+		}
+		cout << setw(24) << left << name << right << setw(10) << pairs.size()
+			 << fixed << setprecision(1);
+		for (int kind=0; kind<4; kind+=1) {
+			if (best[kind] < 1e30) cout << setw(10) << pairs.size()/best[kind]/1e6;
+			else cout << setw(10) << "-";
+		}
+		cout << scientific << setprecision(1) << setw(12) << diff << fixed << endl;
+		if (sink == 12345) cout << endl; // keep the loops
+	}
+	cout << "(max diff: largest change of a cost from the old formulas, relative to the"
+		 << " quadric's constant term, since costs near a minimum cancel)" << endl;
+}
+
+/* Closest point to [p] on the triangle (a, b, c), after Ericson,
+ * Real-Time Collision Detection 5.1.5 */
+static vec3
+closest_on_triangle(const vec3& p, const vec3& a, const vec3& b, const vec3& c) {
+	vec3 ab = b-a, ac = c-a, ap = p-a;
+	float d1 = glm::dot(ab, ap), d2 = glm::dot(ac, ap);
+	if (d1 <= 0 && d2 <= 0) return a;
+	vec3 bp = p-b;
+	float d3 = glm::dot(ab, bp), d4 = glm::dot(ac, bp);
+	if (d3 >= 0 && d4 <= d3) return b;
+	float vc = d1*d4 - d3*d2;
+	if (vc <= 0 && d1 >= 0 && d3 <= 0) return a + ab*(d1/(d1-d3));
+	vec3 cp = p-c;
+	float d5 = glm::dot(ab, cp), d6 = glm::dot(ac, cp);
+	if (d6 >= 0 && d5 <= d6) return c;
+	float vb = d5*d2 - d1*d6;
+	if (vb <= 0 && d2 >= 0 && d6 <= 0) return a + ac*(d2/(d2-d6));
+	float va = d3*d6 - d5*d4;
+	if (va <= 0 && d4-d3 >= 0 && d5-d6 >= 0) return b + (c-b)*((d4-d3)/((d4-d3)+(d5-d6)));
+	float denom = 1/(va+vb+vc);
+	return a + ab*(vb*denom) + ac*(vc*denom);
+}
+
+/* Distance from every vertex of [original] to the nearest face left in
+ * [mesh], both in the prepared frame: the RMS and the largest, as
+ * fractions of the bounding box diagonal. Faces are binned on a grid
+ * and each vertex searches outwards ring by ring. */
+static void
+surface_error(const vector<vertex>& original, const Mesh& mesh, double& rms, double& worst) {
+	vec3 lo(FLT_MAX), hi(-FLT_MAX);
+	for (int i=0; i<original.size(); i+=1) {
+		lo = glm::min(lo, original[i].position);
+		hi = glm::max(hi, original[i].position);
+	}
+	vector<int> tris;
+	for (int i=0; i<mesh.edges.size(); i+=3) {
+		if (!mesh.removed[i/3]) tris.push_back(i);
+	}
+	rms = worst = 0;
+	if (tris.empty() || original.empty()) return;
+	float diagonal = glm::length(hi-lo);
+	int res = max(1, min(128, (int)cbrt((double)tris.size())));
+	vec3 size = glm::max((hi-lo)/(float)res, vec3(diagonal*1e-6f));
+	float step = min(size.x, min(size.y, size.z));
+	vector<vector<int> > cells(res*res*res);
+	for (int t=0; t<tris.size(); t+=1) {
+		vec3 tlo(FLT_MAX), thi(-FLT_MAX);
+		for (int k=0; k<3; k+=1) {
+			vec3 p = mesh.verts[mesh.edges[tris[t]+k].v].position;
+			tlo = glm::min(tlo, p);
+			thi = glm::max(thi, p);
+		}
+		glm::ivec3 c0 = glm::clamp(glm::ivec3((tlo-lo)/size), 0, res-1);
+		glm::ivec3 c1 = glm::clamp(glm::ivec3((thi-lo)/size), 0, res-1);
+		for (int z=c0.z; z<=c1.z; z+=1)
+			for (int y=c0.y; y<=c1.y; y+=1)
+				for (int x=c0.x; x<=c1.x; x+=1)
+					cells[(z*res + y)*res + x].push_back(tris[t]);
+	}
+	double sum = 0;
+	for (int i=0; i<original.size(); i+=1) {
+		vec3 p = original[i].position;
+		glm::ivec3 c = glm::clamp(glm::ivec3((p-lo)/size), 0, res-1);
+		float best = FLT_MAX;
+		for (int r=0; r<res; r+=1) {
+			for (int z=max(0, c.z-r); z<=min(res-1, c.z+r); z+=1)
+				for (int y=max(0, c.y-r); y<=min(res-1, c.y+r); y+=1)
+					for (int x=max(0, c.x-r); x<=min(res-1, c.x+r); x+=1) {
+						if (max(abs(x-c.x), max(abs(y-c.y), abs(z-c.z))) != r) continue;
+						const vector<int>& cell = cells[(z*res + y)*res + x];
+						for (int k=0; k<cell.size(); k+=1) {
+							int h = cell[k];
+							vec3 q = closest_on_triangle(p, mesh.verts[mesh.edges[h].v].position,
+								mesh.verts[mesh.edges[h+1].v].position, mesh.verts[mesh.edges[h+2].v].position);
+							best = min(best, glm::length(p-q));
+						}
+					}
+			if (best <= r*step) break;
+		}
+		sum += (double)best*best;
+		worst = max(worst, (double)best);
+	}
+	rms = sqrt(sum/original.size())/diagonal;
+	worst /= diagonal;
+}
+
+/* Simplification to a tenth of the faces with float, mixed and double
+ * quadric arithmetic: build and simplify time, and the distance from
+ * the input's vertices to the result */
+static void
+bench_precision(int argc, char* argv[]) {
+	const quadric_precision MODES[] = { FLOAT_QUADRICS, MIXED_QUADRICS, DOUBLE_QUADRICS };
+	const char* NAMES[] = { "float", "mixed", "double" };
+	cout << setw(24) << left << "model" << right << setw(10) << "faces";
+	for (int m=0; m<3; m+=1) {
+		cout << setw(9) << NAMES[m] << " ms" << setw(9) << "rms" << setw(9) << "max";
+	}
+	cout << endl;
+	for (int f=0; f<argc; f+=1) {
+		vector<vertex> v;
+		vector<vec3> faces;
+		string name;
+		if (!load_bench_model(argc, argv, f, v, faces, name)) continue;
+		prepareMesh(v, faces);
+		cout << setw(24) << left << name << right << setw(10) << faces.size();
+		for (int m=0; m<3; m+=1) {
+			double best = 1e30, rms = 0, worst = 0;
+			for (int r=0; r<RUNS; r+=1) {
+				double start = wall_time();
+				Mesh mesh(v, faces, 1, MODES[m]);
+				mesh.simplify((int)ceil(faces.size()*0.1));
+				best = min(best, wall_time()-start);
+				if (r == 0) surface_error(v, mesh, rms, worst);
+			}
+			cout << fixed << setprecision(1) << setw(12) << best*1000
+				 << setprecision(3) << setw(9) << rms*1000 << setw(9) << worst*1000;
+		}
+		cout << endl;
+	}
+	cout << "(rms and max: " << DISTANCE_NOTE << ")" << endl;
+}
+
+/* Simplification to a tenth of the faces with eager and lazy updates of
+ * the edges around each collapse: cost evaluations and queue operations
+ * per collapse, the time, and the distance from the input to the result */
+static void
+bench_lazy(int argc, char* argv[]) {
+	const char* NAMES[] = { "eager", "lazy" };
+	cout << setw(24) << left << "model" << right << setw(10) << "faces";
+	for (int m=0; m<2; m+=1) {
+		cout << setw(7) << NAMES[m] << " ms" << setw(8) << "evals" << setw(8) << "heap"
+			 << setw(8) << "rms" << setw(8) << "max";
+	}
+	cout << setw(8) << "evals" << setw(8) << "heap" << endl;
+	double evals[2] = {0, 0}, ops[2] = {0, 0};
+	for (int f=0; f<argc; f+=1) {
+		vector<vertex> v;
+		vector<vec3> faces;
+		string name;
+		if (!load_bench_model(argc, argv, f, v, faces, name)) continue;
+		prepareMesh(v, faces);
+		cout << setw(24) << left << name << right << setw(10) << faces.size();
+		queue_stats stats[2];
+		for (int m=0; m<2; m+=1) {
+			double best = 1e30, rms = 0, worst = 0;
+			for (int r=0; r<RUNS; r+=1) {
+				double start = wall_time();
+				Mesh mesh(v, faces);
+				mesh.lazy = m == 1;
+				mesh.simplify((int)ceil(faces.size()*0.1));
+				best = min(best, wall_time()-start);
+				if (r == 0) {
+					stats[m] = mesh.stats;
+					surface_error(v, mesh, rms, worst);
+				}
+			}
+			long n = max(stats[m].collapses, 1L);
+			evals[m] += stats[m].evaluations;
+			ops[m] += stats[m].heap_ops;
+			cout << fixed << setprecision(1) << setw(10) << best*1000
+				 << setprecision(2) << setw(8) << (double)stats[m].evaluations/n
+				 << setw(8) << (double)stats[m].heap_ops/n
+				 << setprecision(3) << setw(8) << rms*1000 << setw(8) << worst*1000;
+		}
+		cout << setprecision(0) << setw(7) << 100.0*(stats[0].evaluations-stats[1].evaluations)/max(stats[0].evaluations, 1L) << "%"
+			 << setw(7) << 100.0*(stats[0].heap_ops-stats[1].heap_ops)/max(stats[0].heap_ops, 1L) << "%" << endl;
+	}
+	cout << "(evals and heap: per collapse; the last two columns: saved by lazy updates, "
+		 << setprecision(0) << 100*(evals[0]-evals[1])/max(evals[0], 1.0) << "% and "
+		 << 100*(ops[0]-ops[1])/max(ops[0], 1.0) << "% over all models;" << endl
+		 << " rms and max: " << DISTANCE_NOTE << ")" << endl;
+}
+
+typedef boost::heap::binomial_heap<int, boost::heap::compare<edge_compare> > binomial_queue;
+typedef edge_heap<edge_compare> dary_queue;
+typedef edge_buckets<edge_compare> bucket_queue;
+
+#ifdef BINOMIAL_QUEUE
+const char* QUEUE_NAME = "binomial";
+#elif defined(BUCKET_QUEUE)
+const char* QUEUE_NAME = "bucket";
+#else
+const char* QUEUE_NAME = "4-ary";
+#endif
+
+/* Queues ids 0..n-1: one push each into the binomial heap, one bottom-up
+ * pass for the d-ary heap */
+static void
+fill_queue(binomial_queue& pq, vector<binomial_queue::handle_type>& handles, int n) {
+	handles.resize(n);
+	for (int e=0; e<n; e+=1) {
+		handles[e] = pq.push(e);
+	}
+}
+
+static void
+fill_queue(dary_queue& pq, vector<int>& handles, int n) {
+	pq.assign(n);
+	handles.resize(n);
+	for (int e=0; e<n; e+=1) {
+		handles[e] = e;
+	}
+}
+
+static void
+fill_queue(bucket_queue& pq, vector<int>& handles, int n) {
+	pq.assign(n);
+	handles.resize(n);
+	for (int e=0; e<n; e+=1) {
+		handles[e] = e;
+	}
+}
+
+/* Replays what a simplification to a tenth of the edges asks of its
+ * queue, starting from the keys in [start]: each collapse pops the top,
+ * erases two more edges and raises the keys of seven, picked by a fixed
+ * generator. Returns a hash of the popped ids, which every queue must
+ * agree on. */
+template <class Queue>
+static unsigned long long
+queue_trace(const vector<float>& start, double& build, double& churn, size_t& allocs) {
+	vector<float> costs = start;
+	int n = costs.size();
+	vector<int> live(n), slot(n); // queued ids, for picking one at random
+	for (int e=0; e<n; e+=1) {
+		live[e] = slot[e] = e;
+	}
+	int count = n;
+	unsigned long long state = 88172645463325252ULL, hash = 14695981039346656037ULL;
+
+	size_t before = heap_allocations;
+	double start_time = wall_time();
+	Queue pq((edge_compare(&costs)));
+	vector<typename Queue::handle_type> handles;
+	fill_queue(pq, handles, n);
+	double built = wall_time();
+	while (count > n/10 + 10) {
+		int e = pq.top();
+		pq.pop();
+		hash = (hash ^ e) * 1099511628211ULL;
+		for (int k=0; k<10; k+=1) {
+			if (k > 0) {
+				state ^= state << 13;
+				state ^= state >> 7;
+				state ^= state << 17;
+				e = live[state % count];
+			}
+			if (k < 3) {
+				if (k > 0) pq.erase(handles[e]);
+				count -= 1;
+				live[slot[e]] = live[count];
+				slot[live[count]] = slot[e];
+			} else {
+				costs[e] += costs[e]*(state % 64)/32.0f + 1e-6f;
+				pq.update(handles[e]);
+			}
+		}
+	}
+	double done = wall_time();
+	build = built - start_time;
+	churn = done - built;
+	allocs = heap_allocations - before;
+	return hash;
+}
+
+/* [QueueA] against [QueueB], called [names]: building the queue from the
+ * edge costs of each mesh and a replayed simplification, then the whole
+ * simplification with the queue this benchmark was built with */
+template <class QueueA, class QueueB>
+static void
+compare_queues(int argc, char* argv[], const char* names[2]) {
+	cout << setw(24) << left << "model (ms)" << right << setw(10) << "edges";
+	for (int q=0; q<2; q+=1) {
+		cout << setw(strlen(names[q])+7) << string(names[q]) + " build" << setw(10) << "churn"
+			 << setw(10) << "allocs";
+	}
+	cout << setw(9) << "speedup" << setw(10) << "simplify" << endl;
+	for (int f=0; f<argc; f+=1) {
+		vector<vertex> v;
+		vector<vec3> faces;
+		string name;
+		if (!load_bench_model(argc, argv, f, v, faces, name)) continue;
+		prepareMesh(v, faces);
+
+		double simplify = 1e30;
+		vector<float> costs;
+		for (int r=0; r<RUNS; r+=1) {
+			double start = wall_time();
+			Mesh mesh(v, faces);
+			if (r == 0) costs = mesh.merge_costs;
+			mesh.simplify((int)ceil(faces.size()*0.1));
+			simplify = min(simplify, wall_time()-start);
+		}
+
+		double build[2] = {1e30, 1e30}, churn[2] = {1e30, 1e30};
+		size_t allocs[2];
+		unsigned long long hash[2];
+		for (int r=0; r<RUNS; r+=1) {
+			double b, c;
+			hash[0] = queue_trace<QueueA>(costs, b, c, allocs[0]);
+			build[0] = min(build[0], b);
+			churn[0] = min(churn[0], c);
+			hash[1] = queue_trace<QueueB>(costs, b, c, allocs[1]);
+			build[1] = min(build[1], b);
+			churn[1] = min(churn[1], c);
+		}
+		cout << setw(24) << left << name << right << setw(10) << costs.size() << fixed << setprecision(1);
+		for (int q=0; q<2; q+=1) {
+			cout << setw(strlen(names[q])+7) << build[q]*1000 << setw(10) << churn[q]*1000
+				 << setw(10) << allocs[q];
+		}
+		cout << setprecision(2) << setw(9) << (build[0]+churn[0])/(build[1]+churn[1])
+			 << setprecision(1) << setw(10) << simplify*1000 << (hash[0] == hash[1] ? "" : " !") << endl;
+	}
+	cout << "(build and churn: queuing every edge, then the queue operations of collapsing to a"
+		 << " tenth; allocs: both together;" << endl
+		 << " speedup: of the " << names[1] << " queue's build and churn over the " << names[0]
+		 << " queue's; simplify: whole simplification" << endl
+		 << " with the " << QUEUE_NAME << " queue, see QUEUE in the Makefile; '!' marks queues"
+		 << " that popped differently)" << endl;
+}
+
+/* The binomial heap against the indexed 4-ary heap */
+static void
+bench_heap(int argc, char* argv[]) {
+	const char* names[2] = { "binomial", "4-ary" };
+	compare_queues<binomial_queue, dary_queue>(argc, argv, names);
+}
+
+/* The indexed 4-ary heap against the bucket queue */
+static void
+bench_buckets(int argc, char* argv[]) {
+	const char* names[2] = { "4-ary", "bucket" };
+	compare_queues<dary_queue, bucket_queue>(argc, argv, names);
+}
+
+/* Hash of the faces left in [mesh], as the vertex positions of each */
+static unsigned long long
+mesh_hash(const Mesh& mesh) {
+	vector<float> buf;
+	for (int i=0; i<mesh.edges.size(); i+=3) {
+		if (mesh.removed[i/3]) continue;
+		for (int k=0; k<3; k+=1) {
+			const vec3& p = mesh.verts[mesh.edges[i+k].v].position;
+			buf.insert(buf.end(), &p[0], &p[0]+3);
+		}
+	}
+	return buf.empty() ? 0 : hashBytes((const char*)&buf[0], buf.size()*sizeof(float));
+}
+
+/* Simplifies each mesh to a tenth of its faces several times at every
+ * thread count and hashes the result; every hash should match */
+static void
+bench_repro(int argc, char* argv[]) {
+	const int THREADS[] = {1, 2, 4, 8, 16};
+	const int NUM_THREADS = sizeof(THREADS)/sizeof(THREADS[0]);
+	cout << setw(24) << left << "model" << right << setw(10) << "faces"
+		 << setw(20) << "hash" << setw(8) << "runs" << setw(10) << "same" << endl;
+	bool all = true;
+	for (int f=0; f<argc; f+=1) {
+		vector<vertex> v;
+		vector<vec3> faces;
+		string name;
+		if (!load_bench_model(argc, argv, f, v, faces, name)) continue;
+		prepareMesh(v, faces);
+		unsigned long long first = 0;
+		int runs = 0, same = 0;
+		for (int t=0; t<NUM_THREADS; t+=1) {
+			for (int r=0; r<RUNS; r+=1) {
+				Mesh mesh(v, faces, THREADS[t]);
+				mesh.simplify((int)ceil(faces.size()*0.1));
+				unsigned long long h = mesh_hash(mesh);
+				if (runs == 0) first = h;
+				same += h == first;
+				runs += 1;
+			}
+		}
+		all = all && same == runs;
+		cout << setw(24) << left << name << right << setw(10) << faces.size()
+			 << setw(20) << hex << first << dec << setw(8) << runs
+			 << setw(10) << (same == runs ? "yes" : "NO") << endl;
+	}
+	cout << (all ? "(every run matched)" : "(some runs differ)") << endl;
+}
+
+/* Sum over the vertices left in [mesh] of their quadric at their
+ * position: the error the collapses add up, in the units of the costs */
+static double
+quadric_error(const Mesh& mesh) {
+	vector<bool> used(mesh.verts.size(), false);
+	for (int i=0; i<mesh.edges.size(); i+=1) {
+		if (!mesh.removed[i/3]) used[mesh.edges[i].v] = true;
+	}
+	double sum = 0;
+	for (int v=0; v<mesh.verts.size(); v+=1) {
+		if (used[v]) sum += fabs(mesh.verts[v].Q.evaluate(mesh.verts[v].position));
+	}
+	return sum;
+}
+
+/* Simplification to a tenth of the faces by the queue and by drawing K
+ * random edges per collapse: the time, the quadric error of the result
+ * and the distance from the input to it */
+static void
+bench_sample(int argc, char* argv[]) {
+	const int KS[] = { 4, 8, 16 };
+	const int NK = sizeof(KS)/sizeof(KS[0]);
+	cout << setw(24) << left << "model" << right << setw(10) << "faces"
+		 << setw(9) << "heap ms" << setw(10) << "qerr" << setw(8) << "rms";
+	for (int m=0; m<NK; m+=1) {
+		cout << setw(6) << "k=" << setw(2) << left << KS[m] << right << " ms"
+			 << setw(8) << "qerr" << setw(8) << "rms";
+	}
+	cout << endl;
+	for (int f=0; f<argc; f+=1) {
+		vector<vertex> v;
+		vector<vec3> faces;
+		string name;
+		if (!load_bench_model(argc, argv, f, v, faces, name)) continue;
+		prepareMesh(v, faces);
+		cout << setw(24) << left << name << right << setw(10) << faces.size();
+		int target = (int)ceil(faces.size()*0.1);
+		double greedy = 0;
+		for (int m=-1; m<NK; m+=1) {
+			double best = 1e30, error = 0, rms = 0, worst = 0;
+			for (int r=0; r<RUNS; r+=1) {
+				Mesh mesh(v, faces);
+				double start = wall_time();
+				if (m < 0) {
+					mesh.simplify(target);
+				} else {
+					mesh.simplify_sampled(target, KS[m], 1);
+				}
+				best = min(best, wall_time()-start);
+				if (r == 0) {
+					error = quadric_error(mesh);
+					surface_error(v, mesh, rms, worst);
+				}
+			}
+			if (m < 0) {
+				greedy = error;
+				cout << fixed << setprecision(1) << setw(9) << best*1000
+					 << scientific << setprecision(2) << setw(10) << error;
+			} else if (greedy > 0) {
+				cout << fixed << setprecision(1) << setw(11) << best*1000
+					 << setprecision(2) << setw(7) << error/greedy << "x";
+			} else {
+				cout << fixed << setprecision(1) << setw(11) << best*1000 << setw(8) << "-";
+			}
+			cout << fixed << setprecision(3) << setw(8) << rms*1000;
+		}
+		cout << endl;
+	}
+	cout << "(ms: simplification alone, the mesh built beforehand; qerr: quadric error of the"
+		 << " result, for k relative to the heap;" << endl
+		 << " rms: " << DISTANCE_NOTE << ")" << endl;
+}
+
+/* Simplification to a tenth of the faces in one thread and in parallel
+ * rounds at 1 to 16 threads: the times, and the quadric error and
+ * distance to the input of both results */
+static void
+bench_parallel(int argc, char* argv[]) {
+	const int THREADS[] = { 1, 2, 4, 8, 16 };
+	const int NT = sizeof(THREADS)/sizeof(THREADS[0]);
+	cout << setw(24) << left << "model" << right << setw(10) << "faces"
+		 << setw(10) << "serial ms" << setw(10) << "qerr" << setw(8) << "rms";
+	for (int t=0; t<NT; t+=1) {
+		cout << setw(6) << "j=" << setw(2) << left << THREADS[t] << right;
+	}
+	cout << setw(8) << "qerr" << setw(8) << "rms" << endl;
+	for (int f=0; f<argc; f+=1) {
+		vector<vertex> v;
+		vector<vec3> faces;
+		string name;
+		if (!load_bench_model(argc, argv, f, v, faces, name)) continue;
+		prepareMesh(v, faces);
+		cout << setw(24) << left << name << right << setw(10) << faces.size() << flush;
+		int target = (int)ceil(faces.size()*0.1);
+		double serial = 1e30, error[2], rms[2], worst;
+		for (int r=0; r<RUNS; r+=1) {
+			Mesh mesh(v, faces);
+			double start = wall_time();
+			mesh.simplify(target);
+			serial = min(serial, wall_time()-start);
+			if (r == 0) {
+				error[0] = quadric_error(mesh);
+				surface_error(v, mesh, rms[0], worst);
+			}
+		}
+		cout << fixed << setprecision(1) << setw(10) << serial*1000
+			 << scientific << setprecision(2) << setw(10) << error[0]
+			 << fixed << setprecision(3) << setw(8) << rms[0]*1000 << flush;
+		for (int t=0; t<NT; t+=1) {
+			double best = 1e30;
+			for (int r=0; r<RUNS; r+=1) {
+				Mesh mesh(v, faces);
+				double start = wall_time();
+				mesh.simplify_parallel(target, THREADS[t]);
+				best = min(best, wall_time()-start);
+				if (r == 0 && t == 0) {
+					error[1] = quadric_error(mesh);
+					surface_error(v, mesh, rms[1], worst);
+				}
+			}
+			cout << setprecision(2) << setw(7) << serial/best << "x" << flush;
+		}
+		if (error[0] > 0) {
+			cout << setw(7) << error[1]/error[0] << "x";
+		} else {
+			cout << setw(8) << "-";
+		}
+		cout << setprecision(3) << setw(8) << rms[1]*1000 << endl;
+	}
+	cout << "(serial ms: simplify, the mesh built beforehand; j=N: speedup of simplify_parallel on"
+		 << " N threads over it;" << endl
+		 << " qerr: quadric error of the result, for the rounds relative to serial;" << endl
+		 << " rms: " << DISTANCE_NOTE << ")" << endl;
+}
+
+static void
+usage() {
+	cerr << "usage: bench load <mesh.off>...\n"
+		 << "       bench parse <mesh.off>...\n"
+		 << "       bench cache <mesh.off>...\n"
+		 << "       bench ply <mesh.off>...\n"
+		 << "       bench prepare [-synthetic faces] <mesh>...\n"
+		 << "       bench compressed <mesh.off>...\n"
+		 << "       bench build [-synthetic faces] <mesh>...\n"
+		 << "       bench collapse [-synthetic faces] <mesh>...\n"
+		 << "       bench quadric [-synthetic faces] <mesh>...\n"
+		 << "       bench costs [-synthetic faces] <mesh>...\n"
+		 << "       bench precision [-synthetic faces] <mesh>...\n"
+		 << "       bench lazy [-synthetic faces] <mesh>...\n"
+		 << "       bench heap [-synthetic faces] <mesh>...\n"
+		 << "       bench buckets [-synthetic faces] <mesh>...\n"
+		 << "       bench repro [-synthetic faces] <mesh>...\n"
+		 << "       bench sample [-synthetic faces] <mesh>...\n"
+		 << "       bench parallel [-synthetic faces] <mesh>...\n";
+	exit(1);
+}
+
+int main(int argc, char* argv[]) {
+	if (argc < 3) usage();
+	if (!strcmp(argv[1], "load")) {
+		bench_load(argc-2, argv+2);
+	} else if (!strcmp(argv[1], "parse")) {
+		bench_parse(argc-2, argv+2);
+	} else if (!strcmp(argv[1], "cache")) {
+		bench_cache(argc-2, argv+2);
+	} else if (!strcmp(argv[1], "ply")) {
+		bench_ply(argc-2, argv+2);
+	} else if (!strcmp(argv[1], "prepare")) {
+		bench_prepare(argc-2, argv+2);
+	} else if (!strcmp(argv[1], "compressed")) {
+		bench_compressed(argc-2, argv+2);
+	} else if (!strcmp(argv[1], "build")) {
+		bench_build(argc-2, argv+2);
+	} else if (!strcmp(argv[1], "collapse")) {
+		bench_collapse(argc-2, argv+2);
+	} else if (!strcmp(argv[1], "quadric")) {
+		bench_quadric(argc-2, argv+2);
+	} else if (!strcmp(argv[1], "costs")) {
+		bench_costs(argc-2, argv+2);
+	} else if (!strcmp(argv[1], "precision")) {
+		bench_precision(argc-2, argv+2);
+	} else if (!strcmp(argv[1], "heap")) {
+		bench_heap(argc-2, argv+2);
+	} else if (!strcmp(argv[1], "buckets")) {
+		bench_buckets(argc-2, argv+2);
+	} else if (!strcmp(argv[1], "lazy")) {
+		bench_lazy(argc-2, argv+2);
+	} else if (!strcmp(argv[1], "repro")) {
+		bench_repro(argc-2, argv+2);
+	} else if (!strcmp(argv[1], "sample")) {
+		bench_sample(argc-2, argv+2);
+	} else if (!strcmp(argv[1], "parallel")) {
+		bench_parallel(argc-2, argv+2);
+	} else {
+		usage();
+	}
+	return 0;
+}
@@ -0,0 +1,243 @@
+#include <iostream>
+#include <string>
+#include <cstring>
+#include <strings.h>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#include "loader.h"
+#include "timer.h"
+
+using namespace std;
+
+/** Compressed OFF input. The decoder thread and the parser hand blocks
+ * of decompressed text back and forth through a short queue, so the
+ * memory in flight is a few blocks no matter how large the file is. */
+
+const size_t BLOCK_BYTES = 1 << 20;
+const int QUEUE_DEPTH = 4;
+
+/* Bounded queue of decoded blocks; emptied blocks come back as spares */
+struct block_queue {
+	mutex lock;
+	condition_variable changed;
+	deque<string> full;
+	vector<string> spare;
+	bool done;      // the decoder has pushed its last block
+	bool failed;    // the decoder hit corrupt input
+	bool cancelled; // the parser gave up, stop decoding
+	block_queue() : done(false), failed(false), cancelled(false) {}
+
+	/* Hands an empty buffer to the decoder */
+	void take_spare(string& block) {
+		lock_guard<mutex> guard(lock);
+		if (!spare.empty()) {
+			block.swap(spare.back());
+			spare.pop_back();
+		}
+	}
+	/* Queues [block], waiting while the queue is full; false once the
+	 * parser has cancelled */
+	bool push(string& block) {
+		unique_lock<mutex> guard(lock);
+		while (full.size() >= QUEUE_DEPTH && !cancelled) {
+			changed.wait(guard);
+		}
+		if (cancelled) return false;
+		full.push_back(string());
+		full.back().swap(block);
+		changed.notify_all();
+		return true;
+	}
+	void finish(bool ok) {
+		lock_guard<mutex> guard(lock);
+		done = true;
+		failed = !ok;
+		changed.notify_all();
+	}
+	/* Swaps the next block into [block], returning the old contents as a
+	 * spare; false at the end of the stream */
+	bool pop(string& block) {
+		unique_lock<mutex> guard(lock);
+		while (full.empty() && !done) {
+			changed.wait(guard);
+		}
+		if (!block.empty()) {
+			spare.push_back(string());
+			spare.back().swap(block);
+		}
+		if (full.empty()) return false;
+		block.swap(full.front());
+		full.pop_front();
+		changed.notify_all();
+		return true;
+	}
+	void cancel() {
+		lock_guard<mutex> guard(lock);
+		cancelled = true;
+		changed.notify_all();
+	}
+};
+
+/* Inflates gzip (or zlib) data, including concatenated gzip members */
+static bool
+decode_gzip(const char* data, size_t size, block_queue& queue, double& seconds) {
+	z_stream zs;
+	memset(&zs, 0, sizeof(zs));
+	if (inflateInit2(&zs, 15+32) != Z_OK) return false;
+	size_t consumed = 0;
+	bool ok = true;
+	string block;
+	while (ok) {
+		queue.take_spare(block);
+		block.resize(BLOCK_BYTES);
+		double start = wall_time();
+		zs.next_out = (Bytef*)&block[0];
+		zs.avail_out = BLOCK_BYTES;
+		int ret = Z_OK;
+		while (zs.avail_out > 0 && ret == Z_OK) {
+			if (zs.avail_in == 0) {
+				/* avail_in is 32 bits, so huge files are fed in pieces */
+				size_t n = min<size_t>(size-consumed, 1u << 30);
+				zs.next_in = (Bytef*)(data + consumed);
+				zs.avail_in = n;
+				consumed += n;
+			}
+			ret = inflate(&zs, Z_NO_FLUSH);
+			if (ret == Z_STREAM_END && (zs.avail_in > 0 || consumed < size)) {
+				ret = inflateReset(&zs) == Z_OK ? Z_OK : Z_DATA_ERROR;
+			}
+			if (ret == Z_BUF_ERROR && zs.avail_in == 0 && consumed == size) {
+				ret = Z_DATA_ERROR; // input ended mid stream
+			}
+		}
+		seconds += wall_time() - start;
+		ok = ret == Z_OK || ret == Z_STREAM_END;
+		block.resize(BLOCK_BYTES - zs.avail_out);
+		if (ok && !block.empty() && !queue.push(block)) break;
+		if (ret == Z_STREAM_END) break;
+	}
+	inflateEnd(&zs);
+	return ok;
+}
+
+#ifdef HAVE_ZSTD
+static bool
+decode_zstd(const char* data, size_t size, block_queue& queue, double& seconds) {
+	ZSTD_DStream* zs = ZSTD_createDStream();
+	if (!zs) return false;
+	ZSTD_initDStream(zs);
+	ZSTD_inBuffer in = {data, size, 0};
+	size_t ret = 1;
+	bool ok = true;
+	string block;
+	while (ok && (in.pos < in.size || ret != 0)) {
+		queue.take_spare(block);
+		block.resize(BLOCK_BYTES);
+		double start = wall_time();
+		ZSTD_outBuffer out = {&block[0], BLOCK_BYTES, 0};
+		while (out.pos < out.size && (in.pos < in.size || ret != 0)) {
+			size_t before = in.pos + out.pos;
+			ret = ZSTD_decompressStream(zs, &out, &in);
+			if (ZSTD_isError(ret) || in.pos + out.pos == before) {
+				ok = false; // corrupt, or input ended mid frame
+				break;
+			}
+		}
+		seconds += wall_time() - start;
+		block.resize(out.pos);
+		if (ok && !block.empty() && !queue.push(block)) break;
+	}
+	ZSTD_freeDStream(zs);
+	return ok;
+}
+#endif
+
+bool
+readCompressedOFF(const char* filename, vector<vertex>& vertices, vector<vec3>& faces,
+					load_stats* stats) {
+	size_t n = strlen(filename);
+	bool zstd = n >= 4 && !strcasecmp(filename+n-4, ".zst");
+#ifndef HAVE_ZSTD
+	if (zstd) {
+		cout << "Unable to read " << filename << ": built without zstd support" << endl;
+		return false;
+	}
+#endif
+	mapped_file file;
+	if (!file.open(filename)) {
+		cout << "Unable to open file " << filename << endl;
+		return false;
+	}
+
+	block_queue queue;
+	double decodeSeconds = 0;
+	thread decoder([&]() {
+		bool ok;
+#ifdef HAVE_ZSTD
+		if (zstd) {
+			ok = decode_zstd(file.data, file.size, queue, decodeSeconds);
+		} else
+#endif
+		{
+			ok = decode_gzip(file.data, file.size, queue, decodeSeconds);
+		}
+		queue.finish(ok);
+	});
+
+	/* Lines that straddle two blocks are joined in [carry] */
+	off_line_parser parser(filename, vertices, faces);
+	string block, carry;
+	size_t bytes = 0;
+	double parseSeconds = 0;
+	bool ok = true;
+	while (ok && queue.pop(block)) {
+		double t = wall_time();
+		bytes += block.size();
+		const char* p = block.data();
+		const char* end = p + block.size();
+		const char* eol = (const char*)memchr(p, '\n', end-p);
+		if (!eol) {
+			carry.append(p, end);
+		} else {
+			if (!carry.empty()) {
+				carry.append(p, eol+1);
+				ok = parser.feed(carry.data(), carry.data() + carry.size());
+				carry.clear();
+				p = eol+1;
+			}
+			const char* last = end;
+			while (last > p && last[-1] != '\n') --last;
+			ok = ok && parser.feed(p, last);
+			carry.append(last, end);
+		}
+		parseSeconds += wall_time() - t;
+	}
+	if (!ok) {
+		queue.cancel();
+	}
+	decoder.join();
+	if (!ok) return false;
+	if (queue.failed) {
+		cout << "Corrupt compressed file " << filename << endl;
+		return false;
+	}
+	double t = wall_time();
+	ok = parser.finish(carry.data(), carry.data() + carry.size());
+	parseSeconds += wall_time() - t;
+	if (!ok) return false;
+
+	if (stats) {
+		*stats = load_stats();
+		stats->bytes = bytes;
+		stats->compressed_bytes = file.size;
+		stats->parse_seconds = parseSeconds;
+		stats->decompress_seconds = decodeSeconds;
+	}
+	return true;
+}
@@ -0,0 +1,323 @@
+#ifndef EDGE_HEAP_H
+#define EDGE_HEAP_H
+
+#include <vector>
+#include <algorithm>
+#include <cstring>
+
+/********* Indexed d-ary heap of dense edge ids ***********/
+
+/* Keeps ids 0..n-1 in one array, EDGE_HEAP_ARITY children per node, with
+ * the position of every id alongside so an id can be updated or erased
+ * in place. [Compare] orders as for boost::heap: cmp(a, b) is true when
+ * a belongs below b. The interface follows boost::heap's mutable heaps,
+ * with the id itself as the handle. */
+const int EDGE_HEAP_ARITY = 4;
+
+template <class Compare>
+class edge_heap {
+	Compare cmp;
+	std::vector<int> heap; // ids, each above its children
+	std::vector<int> pos;  // index of each id in [heap], -1 if absent
+
+	void place(int i, int id) {
+		heap[i] = id;
+		pos[id] = i;
+	}
+	void sift_up(int i) {
+		int id = heap[i];
+		while (i > 0) {
+			int parent = (i-1)/EDGE_HEAP_ARITY;
+			if (!cmp(heap[parent], id)) break;
+			place(i, heap[parent]);
+			i = parent;
+		}
+		place(i, id);
+	}
+	void sift_down(int i) {
+		int id = heap[i];
+		int n = heap.size();
+		while (true) {
+			int first = i*EDGE_HEAP_ARITY + 1;
+			if (first >= n) break;
+			int last = std::min(first + EDGE_HEAP_ARITY, n);
+			int best = first;
+			for (int c=first+1; c<last; c+=1) {
+				if (cmp(heap[best], heap[c])) best = c;
+			}
+			if (!cmp(id, heap[best])) break;
+			place(i, heap[best]);
+			i = best;
+		}
+		place(i, id);
+	}
+
+  public:
+	typedef int handle_type;
+	typedef std::vector<int>::const_iterator iterator; // in no order
+
+	edge_heap(const Compare& c = Compare()) : cmp(c) {}
+
+	bool empty() const { return heap.empty(); }
+	size_t size() const { return heap.size(); }
+	int top() const { return heap[0]; }
+	iterator begin() const { return heap.begin(); }
+	iterator end() const { return heap.end(); }
+
+	/* Replaces the contents with ids 0..n-1, ordered bottom-up in O(n) */
+	void assign(int n) {
+		heap.resize(n);
+		pos.resize(n);
+		for (int id=0; id<n; id+=1) {
+			heap[id] = id;
+			pos[id] = id;
+		}
+		for (int i=(n-2)/EDGE_HEAP_ARITY; i>=0; i-=1) {
+			sift_down(i);
+		}
+	}
+
+	/* Replaces the contents with [ids], ordered bottom-up in O(ids) */
+	void assign(const std::vector<int>& ids) {
+		clear();
+		heap = ids;
+		for (int i=0; i<heap.size(); i+=1) {
+			if (heap[i] >= pos.size()) pos.resize(heap[i]+1, -1);
+			pos[heap[i]] = i;
+		}
+		for (int i=((int)heap.size()-2)/EDGE_HEAP_ARITY; i>=0; i-=1) {
+			sift_down(i);
+		}
+	}
+
+	handle_type push(int id) {
+		if (id >= pos.size()) pos.resize(id+1, -1);
+		heap.push_back(id);
+		pos[id] = heap.size()-1;
+		sift_up(heap.size()-1);
+		return id;
+	}
+
+	void pop() {
+		erase(heap[0]);
+	}
+
+	void clear() {
+		for (int i=0; i<heap.size(); i+=1) {
+			pos[heap[i]] = -1;
+		}
+		heap.clear();
+	}
+
+	void erase(handle_type id) {
+		int i = pos[id];
+		int last = heap.back();
+		heap.pop_back();
+		pos[id] = -1;
+		if (last == id) return;
+		place(i, last);
+		update(last);
+	}
+
+	/* Restores the order after the key of [id] changed either way */
+	void update(handle_type id) {
+		int i = pos[id];
+		if (i > 0 && cmp(heap[(i-1)/EDGE_HEAP_ARITY], id)) {
+			sift_up(i);
+		} else {
+			sift_down(i);
+		}
+	}
+	void increase(handle_type id) { sift_up(pos[id]); }
+	void decrease(handle_type id) { sift_down(pos[id]); }
+};
+
+/********* Bucket queue of dense edge ids ***********/
+
+/* Buckets by the top bits of the float key: the exponent and
+ * EDGE_BUCKET_BITS of mantissa, so 2^EDGE_BUCKET_BITS buckets per octave
+ * and one bucket for zero and below. Raising the bits of a positive
+ * float never lowers its value, so every key in a bucket is below every
+ * key in the next. */
+const int EDGE_BUCKET_BITS = 2;
+const int EDGE_BUCKET_SHIFT = 23 - EDGE_BUCKET_BITS;
+const int EDGE_BUCKETS = 1 << (31 - EDGE_BUCKET_SHIFT);
+
+/* Same interface as edge_heap, for keys that move a lot and are mostly
+ * pushed far below the top. Only the ids of the lowest buckets, up to
+ * [cut], are kept in order, in an edge_heap; the buckets above are arrays
+ * in no order, so pushing, erasing or updating an id there is O(1). Once
+ * the heap empties, the lowest bucket left is ordered bottom-up and
+ * becomes the cut; an id pushed at or below the cut joins the heap. Pops
+ * come out in exactly the order of edge_heap. [Compare] must keep its
+ * keys as [costs], a pointer to a vector of float indexed by id. */
+template <class Compare>
+class edge_buckets {
+	Compare cmp;
+	edge_heap<Compare> heap;  // the ids of buckets up to [cut], in order
+	int cut;                  // -1 when nothing is queued
+	std::vector<std::vector<int> > buckets; // those above, in no order
+	std::vector<int> where;   // bucket of each id, -1 if absent
+	std::vector<int> pos;     // index of each id in its unordered bucket
+	unsigned long long full[EDGE_BUCKETS/64]; // unordered buckets holding ids
+	size_t count;
+
+	int bucket_of(int id) const {
+		float c = (*cmp.costs)[id];
+		if (!(c > 0)) return 0;
+		unsigned int bits;
+		memcpy(&bits, &c, sizeof(bits));
+		return std::min((int)(bits >> EDGE_BUCKET_SHIFT), EDGE_BUCKETS-1);
+	}
+	void add(int id, int b) {
+		pos[id] = buckets[b].size();
+		buckets[b].push_back(id);
+		full[b/64] |= 1ULL << (b%64);
+	}
+	void remove(int id, int b) {
+		std::vector<int>& ids = buckets[b];
+		int last = ids.back();
+		ids[pos[id]] = last;
+		pos[last] = pos[id];
+		ids.pop_back();
+		if (ids.empty()) full[b/64] &= ~(1ULL << (b%64));
+	}
+	/* Orders the lowest unordered bucket once the heap has emptied */
+	void refill() {
+		if (!heap.empty()) return;
+		cut = -1;
+		for (int w=0; w<EDGE_BUCKETS/64; w+=1) {
+			if (!full[w]) continue;
+			cut = w*64 + __builtin_ctzll(full[w]);
+			heap.assign(buckets[cut]);
+			buckets[cut].clear();
+			full[w] &= full[w]-1;
+			return;
+		}
+	}
+
+  public:
+	typedef int handle_type;
+
+	edge_buckets(const Compare& c = Compare())
+		: cmp(c), heap(c), cut(-1), buckets(EDGE_BUCKETS), count(0) {
+		memset(full, 0, sizeof(full));
+	}
+
+	bool empty() const { return count == 0; }
+	size_t size() const { return count; }
+	int top() const { return heap.top(); }
+
+	/* Replaces the contents with ids 0..n-1 */
+	void assign(int n) {
+		clear();
+		where.resize(n);
+		pos.resize(n);
+		for (int id=0; id<n; id+=1) {
+			where[id] = bucket_of(id);
+			add(id, where[id]);
+		}
+		count = n;
+		refill();
+	}
+
+	handle_type push(int id) {
+		if (id >= where.size()) {
+			where.resize(id+1, -1);
+			pos.resize(id+1);
+		}
+		int b = bucket_of(id);
+		where[id] = b;
+		count += 1;
+		if (b <= cut) {
+			heap.push(id);
+		} else {
+			add(id, b);
+			refill();
+		}
+		return id;
+	}
+
+	void pop() {
+		erase(heap.top());
+	}
+
+	void clear() {
+		heap.clear();
+		for (int b=0; b<EDGE_BUCKETS; b+=1) {
+			buckets[b].clear();
+		}
+		where.assign(where.size(), -1);
+		memset(full, 0, sizeof(full));
+		cut = -1;
+		count = 0;
+	}
+
+	void erase(handle_type id) {
+		int b = where[id];
+		where[id] = -1;
+		count -= 1;
+		if (b > cut) {
+			remove(id, b);
+		} else {
+			heap.erase(id);
+			refill();
+		}
+	}
+
+	/* Restores the order after the key of [id] changed either way; O(1)
+	 * unless [id] is in the heap or joins it */
+	void update(handle_type id) {
+		int b = bucket_of(id);
+		int old = where[id];
+		where[id] = b;
+		if (old > cut) {
+			if (b == old) return;
+			remove(id, old);
+			if (b <= cut) {
+				heap.push(id);
+			} else {
+				add(id, b);
+			}
+		} else if (b <= cut) {
+			heap.update(id);
+		} else {
+			heap.erase(id);
+			add(id, b);
+			refill();
+		}
+	}
+	void increase(handle_type id) { update(id); }
+	void decrease(handle_type id) { update(id); }
+};
+
+/* Unordered set of dense edge ids with the index of each, so an id is
+ * inserted or erased and the i-th member read in O(1); members can be
+ * drawn uniformly at random */
+class edge_set {
+	std::vector<int> ids;
+	std::vector<int> pos; // index of each id in [ids], -1 if absent
+
+  public:
+	bool empty() const { return ids.empty(); }
+	size_t size() const { return ids.size(); }
+	int operator[](size_t i) const { return ids[i]; }
+
+	void insert(int id) {
+		if (id >= pos.size()) pos.resize(id+1, -1);
+		if (pos[id] >= 0) return;
+		pos[id] = ids.size();
+		ids.push_back(id);
+	}
+
+	void erase(int id) {
+		if (id >= pos.size() || pos[id] < 0) return;
+		int last = ids.back();
+		ids[pos[id]] = last;
+		pos[last] = pos[id];
+		pos[id] = -1;
+		ids.pop_back();
+	}
+};
+
+#endif //EDGE_HEAP_H
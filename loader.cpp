@@ -0,0 +1,889 @@
+#include <iostream>
+#include <sstream>
+#include <fstream>
+#include <string>
+#include <cmath>
+#include <cstring>
+#include <strings.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdint.h>
+#include <cstdio>
+#include <climits>
+#include <algorithm>
+#include "loader.h"
+#include "threadpool.h"
+#include "timer.h"
+
+using namespace std;
+
+/** Memory mapped file **/
+
+mapped_file::mapped_file() : data(NULL), size(0) {}
+
+mapped_file::~mapped_file() {
+	close();
+}
+
+bool
+mapped_file::open(const char* filename) {
+	close();
+	int fd = ::open(filename, O_RDONLY);
+	if (fd < 0) return false;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		::close(fd);
+		return false;
+	}
+	void* p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (p == MAP_FAILED) return false;
+	madvise(p, st.st_size, MADV_SEQUENTIAL);
+	data = (const char*)p;
+	size = st.st_size;
+	return true;
+}
+
+void
+mapped_file::close() {
+	if (data) {
+		munmap((void*)data, size);
+	}
+	data = NULL;
+	size = 0;
+}
+
+load_stats::load_stats() : bytes(0), threads(1), parse_seconds(0), from_cache(false),
+		compressed_bytes(0), decompress_seconds(0) {}
+
+double
+load_stats::megabytes_per_second() const {
+	return parse_seconds > 0 ? bytes/(1024.0*1024.0)/parse_seconds : 0;
+}
+
+/** Number scanning straight out of the mapped bytes **/
+
+static const double POW10[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static inline bool
+is_space(char c) {
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+}
+
+static inline bool
+is_digit(char c) {
+	return (unsigned)(c - '0') < 10;
+}
+
+/* Skips whitespace and '#' comments */
+static inline const char*
+skip_space(const char* p, const char* end) {
+	while (p < end) {
+		if (is_space(*p)) {
+			++p;
+		} else if (*p == '#') {
+			while (p < end && *p != '\n') ++p;
+		} else {
+			break;
+		}
+	}
+	return p;
+}
+
+/* Moves past the end of the current line */
+const char*
+skip_line(const char* p, const char* end) {
+	while (p < end && *p != '\n') ++p;
+	return p < end ? p+1 : end;
+}
+
+/* Returns NULL if there is no integer at [p] */
+static inline const char*
+scan_int(const char* p, const char* end, int& out) {
+	p = skip_space(p, end);
+	bool neg = false;
+	if (p < end && (*p == '-' || *p == '+')) {
+		neg = *p == '-';
+		++p;
+	}
+	if (p == end || !is_digit(*p)) return NULL;
+	unsigned long long val = 0;
+	while (p < end && is_digit(*p)) {
+		val = val*10 + (*p - '0');
+		if (val > INT_MAX) return NULL; // too large for an int
+		++p;
+	}
+	out = neg ? -(int)val : (int)val;
+	return p;
+}
+
+/* Returns NULL if there is no floating point number at [p] */
+static inline const char*
+scan_float(const char* p, const char* end, float& out) {
+	p = skip_space(p, end);
+	bool neg = false;
+	if (p < end && (*p == '-' || *p == '+')) {
+		neg = *p == '-';
+		++p;
+	}
+	unsigned long long mantissa = 0;
+	int digits = 0;
+	int exponent = 0;
+	bool any = false;
+	while (p < end && is_digit(*p)) {
+		if (digits < 19) {
+			mantissa = mantissa*10 + (*p - '0');
+			if (mantissa) digits += 1;
+		} else {
+			exponent += 1;
+		}
+		any = true;
+		++p;
+	}
+	if (p < end && *p == '.') {
+		++p;
+		while (p < end && is_digit(*p)) {
+			if (digits < 19) {
+				mantissa = mantissa*10 + (*p - '0');
+				if (mantissa) digits += 1;
+				exponent -= 1;
+			}
+			any = true;
+			++p;
+		}
+	}
+	if (!any) return NULL;
+	if (p < end && (*p == 'e' || *p == 'E')) {
+		int e;
+		const char* q = p+1;
+		if (q < end && !is_space(*q) && (q = scan_int(q, end, e))) {
+			exponent += e;
+			p = q;
+		}
+	}
+	double val = (double)mantissa;
+	if (exponent < 0) {
+		val = (exponent >= -22) ? val / POW10[-exponent] : val * pow(10.0, exponent);
+	} else if (exponent > 0) {
+		val = (exponent <= 22) ? val * POW10[exponent] : val * pow(10.0, exponent);
+	}
+	out = (float)(neg ? -val : val);
+	return p;
+}
+
+/** Readers **/
+
+/* Reads the "OFF" keyword and the element counts */
+const char*
+scan_off_header(const char* p, const char* end, int& numVerts, int& numFaces) {
+	p = skip_space(p, end);
+	if (end-p >= 3 && p[0] == 'O' && p[1] == 'F' && p[2] == 'F') {
+		p += 3;
+	}
+	if (!(p = scan_int(p, end, numVerts)) || !(p = scan_int(p, end, numFaces))) {
+		return NULL;
+	}
+	if (numVerts < 0 || numFaces < 0) return NULL;
+	return skip_line(p, end);
+}
+
+const char*
+scan_vertex(const char* p, const char* end, vertex& v) {
+	float x,y,z;
+	if (!(p = scan_float(p, end, x)) ||
+		!(p = scan_float(p, end, y)) ||
+		!(p = scan_float(p, end, z))) {
+		return NULL;
+	}
+	v = vertex(x,y,z);
+	return p;
+}
+
+const char*
+scan_polygon(const char* p, const char* end, int numVerts, vector<int>& ids) {
+	int n;
+	if (!(p = scan_int(p, end, n)) || n < 3) {
+		return NULL;
+	}
+	ids.resize(n);
+	for (int k=0; k<n; k+=1) {
+		if (!(p = scan_int(p, end, ids[k])) || ids[k] < 0 || ids[k] >= numVerts) {
+			return NULL;
+		}
+	}
+	return p;
+}
+
+const char*
+scan_face(const char* p, const char* end, int numVerts, vector<int>& ids, vector<vec3>& tris) {
+	if (!(p = scan_polygon(p, end, numVerts, ids))) {
+		return NULL;
+	}
+	for (int k=1; k+1<ids.size(); k+=1) {
+		tris.push_back(vec3(ids[0],ids[k],ids[k+1]));
+	}
+	return p;
+}
+
+/* Finds the start of the line following [p], or [end] */
+static inline const char*
+next_line(const char* p, const char* end) {
+	const char* eol = (const char*)memchr(p, '\n', end-p);
+	return eol ? eol+1 : end;
+}
+
+/* Returns the first character of a record on the line at [p], or NULL
+ * if the line is blank or a comment */
+static inline const char*
+record_start(const char* p, const char* eol) {
+	while (p < eol && (*p == ' ' || *p == '\t' || *p == '\r')) ++p;
+	if (p == eol || *p == '\n' || *p == '#') return NULL;
+	return p;
+}
+
+/** Chunked parsing: the body is cut into newline aligned chunks, the
+ * records in each chunk are counted in parallel, and a prefix sum over
+ * the counts gives every chunk the index of its first record. The
+ * chunks are then parsed in parallel straight into their slots. */
+
+struct off_chunk {
+	const char* begin;
+	const char* end;
+	int first_record;
+	int num_records;
+	vector<vec3> tris; // fans of the polygons in this chunk
+	bool ok;
+};
+
+static void
+split_chunks(const char* begin, const char* end, int count, vector<off_chunk>& chunks) {
+	chunks.clear();
+	const char* prev = begin;
+	for (int i=1; i<=count; i+=1) {
+		const char* cut = (i == count) ? end : begin + (end-begin)*(long long)i/count;
+		if (cut < prev) cut = prev;
+		while (cut < end && cut > begin && cut[-1] != '\n') ++cut;
+		off_chunk c;
+		c.begin = prev;
+		c.end = cut;
+		c.first_record = 0;
+		c.num_records = 0;
+		c.ok = true;
+		chunks.push_back(c);
+		prev = cut;
+	}
+}
+
+static void
+count_records(off_chunk& c) {
+	int n = 0;
+	for (const char* p = c.begin; p < c.end; p = next_line(p, c.end)) {
+		if (record_start(p, c.end)) n += 1;
+	}
+	c.num_records = n;
+}
+
+static void
+parse_records(off_chunk& c, int numVerts, int numFaces, vector<vertex>& vertices) {
+	vector<int> ids;
+	int r = c.first_record;
+	for (const char* p = c.begin; p < c.end && c.ok; ) {
+		const char* eol = next_line(p, c.end);
+		const char* rec = record_start(p, eol);
+		p = eol;
+		if (!rec) continue;
+		if (r < numVerts) {
+			c.ok = scan_vertex(rec, eol, vertices[r]) != NULL;
+		} else if (r < numVerts+numFaces) {
+			c.ok = scan_face(rec, eol, numVerts, ids, c.tris) != NULL;
+		}
+		r += 1;
+	}
+}
+
+static bool
+readOFFChunked(const char* filename, const char* p, const char* end, int threads,
+				int numVerts, int numFaces,
+				vector<vertex>& vertices, vector<vec3>& faces) {
+	const long long CHUNK_BYTES = 1 << 20;
+	int count = (end-p)/CHUNK_BYTES + 1;
+	count = max(count, threads*4);
+	count = min<long long>(count, (end-p)/64 + 1);
+
+	vector<off_chunk> chunks;
+	split_chunks(p, end, count, chunks);
+	parallel_for(threads, chunks.size(), [&](int i) {
+		count_records(chunks[i]);
+	});
+	int total = 0;
+	for (int i=0; i<chunks.size(); i+=1) {
+		chunks[i].first_record = total;
+		total += chunks[i].num_records;
+	}
+	if (total < numVerts+numFaces) {
+		cout << "Malformed OFF file " << filename << ": expected " << numVerts+numFaces
+			 << " records, found " << total << endl;
+		return false;
+	}
+
+	vertices.assign(numVerts, vertex());
+	parallel_for(threads, chunks.size(), [&](int i) {
+		parse_records(chunks[i], numVerts, numFaces, vertices);
+	});
+
+	/* Polygons give a variable number of triangles, so the per-chunk
+	 * fans are concatenated in chunk order */
+	vector<size_t> offset(chunks.size()+1, 0);
+	for (int i=0; i<chunks.size(); i+=1) {
+		if (!chunks[i].ok) {
+			cout << "Malformed OFF record in " << filename << endl;
+			return false;
+		}
+		offset[i+1] = offset[i] + chunks[i].tris.size();
+	}
+	faces.resize(offset.back());
+	parallel_for(threads, chunks.size(), [&](int i) {
+		copy(chunks[i].tris.begin(), chunks[i].tris.end(), faces.begin()+offset[i]);
+		vector<vec3>().swap(chunks[i].tris);
+	});
+	return true;
+}
+
+bool
+readOFF(const char* filename, vector<vertex>& vertices, vector<vec3>& faces,
+		int threads, load_stats* stats) {
+	double start = wall_time();
+	mapped_file file;
+	if (!file.open(filename)) {
+		cout << "Unable to open file " << filename << endl;
+		return false;
+	}
+	const char* p = file.data;
+	const char* end = file.data + file.size;
+
+	int numVerts, numFaces;
+	if (!(p = scan_off_header(p, end, numVerts, numFaces))) {
+		cout << "Malformed OFF header in " << filename << endl;
+		return false;
+	}
+
+	vertices.clear();
+	faces.clear();
+	if (threads > 1) {
+		if (!readOFFChunked(filename, p, end, threads, numVerts, numFaces, vertices, faces)) {
+			return false;
+		}
+	} else {
+		vertices.reserve(numVerts);
+		faces.reserve(numFaces);
+
+		for (int i=0; i<numVerts; i+=1) {
+			vertex v;
+			if (!(p = scan_vertex(p, end, v))) {
+				cout << "Malformed vertex " << i << " in " << filename << endl;
+				return false;
+			}
+			p = skip_line(p, end);
+			vertices.push_back(v);
+		}
+
+		vector<int> ids;
+		for (int i=0; i<numFaces; i+=1) {
+			if (!(p = scan_face(p, end, numVerts, ids, faces))) {
+				cout << "Malformed face " << i << " in " << filename << endl;
+				return false;
+			}
+			p = skip_line(p, end);
+		}
+	}
+
+	if (stats) {
+		*stats = load_stats();
+		stats->bytes = file.size;
+		stats->threads = max(threads, 1);
+		stats->parse_seconds = wall_time() - start;
+	}
+	return true;
+}
+
+/** Line at a time parsing, for decompressed input **/
+
+off_line_parser::off_line_parser(const char* filename, vector<vertex>& vertices, vector<vec3>& faces)
+	: filename(filename), vertices(vertices), faces(faces), numVerts(-1), numFaces(-1), record(0) {
+	vertices.clear();
+	faces.clear();
+}
+
+bool
+off_line_parser::feed(const char* p, const char* end) {
+	while (p < end) {
+		const char* eol = next_line(p, end);
+		const char* rec = record_start(p, eol);
+		p = eol;
+		if (!rec) continue;
+		if (numVerts < 0) {
+			/* The keyword may sit on its own line above the counts */
+			if (eol-rec >= 3 && !memcmp(rec, "OFF", 3) && skip_space(rec+3, eol) == eol) {
+				continue;
+			}
+			if (!scan_off_header(rec, eol, numVerts, numFaces)) {
+				cout << "Malformed OFF header in " << filename << endl;
+				return false;
+			}
+			vertices.reserve(numVerts);
+			faces.reserve(numFaces);
+		} else if (record < numVerts) {
+			vertex v;
+			if (!scan_vertex(rec, eol, v)) {
+				cout << "Malformed vertex " << record << " in " << filename << endl;
+				return false;
+			}
+			vertices.push_back(v);
+			record += 1;
+		} else if (record < numVerts+numFaces) {
+			if (!scan_face(rec, eol, numVerts, ids, faces)) {
+				cout << "Malformed face " << record-numVerts << " in " << filename << endl;
+				return false;
+			}
+			record += 1;
+		}
+	}
+	return true;
+}
+
+bool
+off_line_parser::finish(const char* p, const char* end) {
+	if (!feed(p, end)) return false;
+	if (numVerts < 0 || record < numVerts+numFaces) {
+		cout << "Truncated OFF file " << filename << endl;
+		return false;
+	}
+	return true;
+}
+
+static inline bool
+has_suffix(const char* filename, const char* suffix) {
+	size_t n = strlen(filename), m = strlen(suffix);
+	return n >= m && !strcasecmp(filename+n-m, suffix);
+}
+
+bool
+readMeshFile(const char* filename, vector<vertex>& vertices, vector<vec3>& faces,
+				int threads, load_stats* stats) {
+	if (has_suffix(filename, ".gz") || has_suffix(filename, ".zst")) {
+		return readCompressedOFF(filename, vertices, faces, stats);
+	}
+	if (has_suffix(filename, ".ply")) {
+		return readPLY(filename, vertices, faces, threads, stats);
+	}
+	return readOFF(filename, vertices, faces, threads, stats);
+}
+
+bool
+readOFFStream(const char* filename, vector<vertex>& vertices, vector<vec3>& faces) {
+	ifstream myfile(filename, ifstream::in);
+	if(!myfile.is_open()){
+		cout << "Unable to open file " << filename << endl;
+		return false;
+	}
+
+	int numVerts, numFaces;
+	string line;
+
+	getline(myfile, line); //skip first line
+	getline(myfile, line);
+	stringstream firstln(line);
+	firstln >> numVerts >> numFaces;
+
+	vertices.clear();
+	faces.clear();
+	vertices.reserve(numVerts);
+	faces.reserve(numFaces);
+
+	for (int i=0; i<numVerts; i+=1){
+		float x,y,z;
+		getline(myfile, line);
+		stringstream ln(line);
+		ln >> x >> y >> z;
+		vertices.push_back(vertex(x,y,z));
+	}
+
+	for (int i=0; i<numFaces; i+=1){
+		int vid0,vid1,vid2,junk;
+		getline(myfile, line);
+		stringstream ln(line);
+		ln >> junk >> vid0 >> vid1 >> vid2;
+		faces.push_back(vec3(vid0,vid1,vid2));
+	}
+	myfile.close();
+	return true;
+}
+
+bool
+loadMesh(const char* filename, vector<vertex>& vertices, vector<vec3>& faces,
+			int threads, bool use_cache, load_stats* stats) {
+	double start = wall_time();
+	if (use_cache && readCache(filename, vertices, faces, threads)) {
+		if (stats) {
+			struct stat st;
+			*stats = load_stats();
+			stats->bytes = stat(cacheFilename(filename).c_str(), &st) == 0 ? st.st_size : 0;
+			stats->threads = max(threads, 1);
+			stats->parse_seconds = wall_time() - start;
+			stats->from_cache = true;
+		}
+		return true;
+	}
+	if (!readMeshFile(filename, vertices, faces, threads, stats)) {
+		return false;
+	}
+	prepareMesh(vertices, faces, threads);
+	if (use_cache) {
+		writeCache(filename, vertices, faces, threads);
+	}
+	return true;
+}
+
+/** Binary mesh cache **/
+
+const char CACHE_MAGIC[4] = {'M','S','H','C'};
+/* Bump whenever prepareMesh changes the normals or quadrics it stores,
+ * so caches written by an older build are rebuilt */
+const uint32_t CACHE_VERSION = 2;
+const uint32_t CACHE_VERTEX_FLOATS = 16; // position, normal, Q[10]
+const size_t HASH_BLOCK = 1 << 20;
+
+struct cache_header {
+	char magic[4];
+	uint32_t version;
+	uint64_t source_size;
+	int64_t source_mtime;
+	uint64_t source_hash;
+	uint32_t num_verts;
+	uint32_t num_faces;
+	uint32_t vertex_floats;
+	uint32_t reserved;
+};
+
+static inline uint64_t
+mix64(uint64_t h) {
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+static uint64_t
+hash_block(const char* p, size_t n) {
+	const uint64_t K = 0x9e3779b97f4a7c15ULL;
+	uint64_t h = n * K;
+	size_t i = 0;
+	for (; i+8 <= n; i+=8) {
+		uint64_t w;
+		memcpy(&w, p+i, 8);
+		h = (h ^ (w * K)) * 0x100000001b3ULL;
+		h = (h << 29) | (h >> 35);
+	}
+	uint64_t tail = 0;
+	memcpy(&tail, p+i, n-i);
+	return mix64(h ^ tail);
+}
+
+unsigned long long
+hashBytes(const char* data, size_t size, int threads) {
+	int blocks = (size + HASH_BLOCK-1) / HASH_BLOCK;
+	vector<uint64_t> hashes(blocks);
+	parallel_for(threads, blocks, [&](int b) {
+		size_t begin = b*HASH_BLOCK;
+		hashes[b] = hash_block(data+begin, min(HASH_BLOCK, size-begin));
+	});
+	uint64_t h = mix64(size);
+	for (int b=0; b<blocks; b+=1) {
+		h = mix64(h ^ hashes[b]) + b;
+	}
+	return h;
+}
+
+string
+cacheFilename(const char* source) {
+	return string(source) + ".cache";
+}
+
+bool
+readCache(const char* source, vector<vertex>& vertices, vector<vec3>& faces, int threads) {
+	struct stat st;
+	if (stat(source, &st) != 0) return false;
+	string name = cacheFilename(source);
+	mapped_file cache;
+	if (!cache.open(name.c_str())) return false;
+
+	cache_header header;
+	if (cache.size < sizeof(header)) return false;
+	memcpy(&header, cache.data, sizeof(header));
+	if (memcmp(header.magic, CACHE_MAGIC, 4) != 0 ||
+		header.version != CACHE_VERSION ||
+		header.vertex_floats != CACHE_VERTEX_FLOATS) {
+		cout << "Ignoring " << name << ": unknown cache version" << endl;
+		return false;
+	}
+	size_t expected = sizeof(header) + header.num_verts*(size_t)CACHE_VERTEX_FLOATS*sizeof(float)
+							+ header.num_faces*(size_t)3*sizeof(uint32_t);
+	if (cache.size != expected || header.num_verts > INT_MAX || header.num_faces > INT_MAX) {
+		cout << "Ignoring " << name << ": truncated cache" << endl;
+		return false;
+	}
+	if (header.source_size != (uint64_t)st.st_size || header.source_mtime != (int64_t)st.st_mtime) {
+		cout << "Ignoring " << name << ": stale cache" << endl;
+		return false;
+	}
+	mapped_file src;
+	if (!src.open(source) || hashBytes(src.data, src.size, threads) != header.source_hash) {
+		cout << "Ignoring " << name << ": source contents changed" << endl;
+		return false;
+	}
+	src.close();
+
+	const float* vdata = (const float*)(cache.data + sizeof(header));
+	const uint32_t* fdata = (const uint32_t*)(vdata + header.num_verts*(size_t)CACHE_VERTEX_FLOATS);
+	int numVerts = header.num_verts;
+	int numFaces = header.num_faces;
+	vertices.assign(numVerts, vertex());
+	faces.assign(numFaces, vec3());
+	parallel_for(threads, (numVerts+65535)/65536, [&](int b) {
+		int end = min(numVerts, (b+1)*65536);
+		for (int i=b*65536; i<end; i+=1) {
+			const float* f = vdata + i*(size_t)CACHE_VERTEX_FLOATS;
+			vertex& v = vertices[i];
+			v.position = vec3(f[0], f[1], f[2]);
+			v.normal = vec3(f[3], f[4], f[5]);
+			memcpy(v.Q.q, f+6, 10*sizeof(float));
+		}
+	});
+	int blocks = (numFaces+65535)/65536;
+	vector<char> bad(blocks, 0);
+	parallel_for(threads, blocks, [&](int b) {
+		int end = min(numFaces, (b+1)*65536);
+		for (int i=b*65536; i<end; i+=1) {
+			const uint32_t* f = fdata + i*3;
+			if (f[0] >= header.num_verts || f[1] >= header.num_verts || f[2] >= header.num_verts) {
+				bad[b] = 1;
+				return;
+			}
+			faces[i] = vec3(f[0], f[1], f[2]);
+		}
+	});
+	if (find(bad.begin(), bad.end(), 1) != bad.end()) {
+		cout << "Ignoring " << name << ": face index out of range" << endl;
+		vertices.clear();
+		faces.clear();
+		return false;
+	}
+	return true;
+}
+
+bool
+writeCache(const char* source, const vector<vertex>& vertices, const vector<vec3>& faces, int threads) {
+	struct stat st;
+	mapped_file src;
+	if (stat(source, &st) != 0 || !src.open(source)) return false;
+
+	cache_header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, CACHE_MAGIC, 4);
+	header.version = CACHE_VERSION;
+	header.source_size = st.st_size;
+	header.source_mtime = st.st_mtime;
+	header.source_hash = hashBytes(src.data, src.size, threads);
+	header.num_verts = vertices.size();
+	header.num_faces = faces.size();
+	header.vertex_floats = CACHE_VERTEX_FLOATS;
+	src.close();
+
+	string name = cacheFilename(source);
+	string tmp = name + ".tmp";
+	FILE* out = fopen(tmp.c_str(), "wb");
+	if (!out) {
+		cout << "Unable to write cache " << name << endl;
+		return false;
+	}
+	bool ok = fwrite(&header, sizeof(header), 1, out) == 1;
+
+	vector<float> vbuf;
+	for (int i=0; ok && i<vertices.size(); i+=1) {
+		const vertex& v = vertices[i];
+		vbuf.insert(vbuf.end(), &v.position[0], &v.position[0]+3);
+		vbuf.insert(vbuf.end(), &v.normal[0], &v.normal[0]+3);
+		vbuf.insert(vbuf.end(), v.Q.q, v.Q.q+10);
+		if (vbuf.size() >= 65536 || i+1 == vertices.size()) {
+			ok = fwrite(&vbuf[0], sizeof(float), vbuf.size(), out) == vbuf.size();
+			vbuf.clear();
+		}
+	}
+	vector<uint32_t> fbuf;
+	for (int i=0; ok && i<faces.size(); i+=1) {
+		fbuf.push_back(faces[i][0]);
+		fbuf.push_back(faces[i][1]);
+		fbuf.push_back(faces[i][2]);
+		if (fbuf.size() >= 65536 || i+1 == faces.size()) {
+			ok = fwrite(&fbuf[0], sizeof(uint32_t), fbuf.size(), out) == fbuf.size();
+			fbuf.clear();
+		}
+	}
+	ok = (fclose(out) == 0) && ok;
+	if (!ok || rename(tmp.c_str(), name.c_str()) != 0) {
+		remove(tmp.c_str());
+		cout << "Unable to write cache " << name << endl;
+		return false;
+	}
+	return true;
+}
+
+/* Fixed block size for the per-vertex and per-face passes below */
+const int PREPARE_BLOCK = 65536;
+
+void
+prepareMesh(vector<vertex>& vertices, vector<vec3>& faces, int threads,
+			mesh_transform* transform) {
+	int numVerts = vertices.size();
+	int numBlocks = (numVerts + PREPARE_BLOCK-1)/PREPARE_BLOCK;
+
+	/* Bounding box; min and max give the same answer in any order */
+	vector<vec3> blockMin(numBlocks, vec3(999999)), blockMax(numBlocks, vec3(-999999));
+	parallel_for(threads, numBlocks, [&](int b) {
+		int end = min(numVerts, (b+1)*PREPARE_BLOCK);
+		for (int i=b*PREPARE_BLOCK; i<end; i+=1) {
+			blockMin[b] = glm::min(blockMin[b], vertices[i].position);
+			blockMax[b] = glm::max(blockMax[b], vertices[i].position);
+		}
+	});
+	vec3 lo(999999), hi(-999999);
+	for (int b=0; b<numBlocks; b+=1) {
+		lo = glm::min(lo, blockMin[b]);
+		hi = glm::max(hi, blockMax[b]);
+	}
+
+	/*** Center model around origin  ***/
+
+	vec3 makeMiddle = (hi+lo)/2.0f;
+	float ratio = 8.0/max(max(hi.x-lo.x, hi.y-lo.y), hi.z-lo.z);
+	if (transform) {
+		transform->middle = makeMiddle;
+		transform->scale = ratio;
+	}
+	parallel_for(threads, numBlocks, [&](int b) {
+		int end = min(numVerts, (b+1)*PREPARE_BLOCK);
+		for (int i=b*PREPARE_BLOCK; i<end; i+=1) {
+			vertices[i].position -= makeMiddle;
+			vertices[i].position *= ratio;
+		}
+	});
+
+	/* Scaling is uniform, so normals from the scaled positions point the
+	 * same way as normals from the raw ones */
+	accumulateNormalsAndQuadrics(vertices, faces, threads);
+
+	parallel_for(threads, numBlocks, [&](int b) {
+		int end = min(numVerts, (b+1)*PREPARE_BLOCK);
+		for (int i=b*PREPARE_BLOCK; i<end; i+=1) {
+			vertices[i].normal = glm::normalize(vertices[i].normal);
+		}
+	});
+}
+
+/* Area weighted normal and plane quadric of one face */
+struct face_terms {
+	vec3 normal;
+	quadric Q;
+};
+
+static inline void
+compute_face_terms(const vector<vertex>& vertices, const vec3& f, face_terms& t) {
+	vec3 v0 = vertices[(int)f[0]].position;
+	vec3 v1 = vertices[(int)f[1]].position;
+	vec3 v2 = vertices[(int)f[2]].position;
+
+	vec3 norm = glm::cross(v1-v0,v2-v0);
+	t.normal = norm;
+	norm = glm::normalize(norm);
+	vec4 p = vec4(norm,-glm::dot(norm,v0));
+
+	/** Calculate Quadratic error matrix **/
+	t.Q = quadric(p);
+}
+
+static inline void
+add_face_terms(vertex& v, const face_terms& t) {
+	v.normal += t.normal;
+	v.Q += t.Q;
+}
+
+void
+accumulateNormalsAndQuadrics(vector<vertex>& vertices, vector<vec3>& faces, int threads) {
+	int numVerts = vertices.size();
+	int numFaces = faces.size();
+
+	/* One thread scatters each face straight into its vertices; that adds
+	 * to every vertex in face order, the same order the gather uses */
+	if (threads <= 1) {
+		for (int i=0; i<numFaces; i+=1) {
+			face_terms t;
+			compute_face_terms(vertices, faces[i], t);
+			add_face_terms(vertices[(int)faces[i][0]], t);
+			add_face_terms(vertices[(int)faces[i][1]], t);
+			add_face_terms(vertices[(int)faces[i][2]], t);
+		}
+		return;
+	}
+
+	int faceBlocks = (numFaces + PREPARE_BLOCK-1)/PREPARE_BLOCK;
+	int vertBlocks = (numVerts + PREPARE_BLOCK-1)/PREPARE_BLOCK;
+
+	/** Each face's normal and plane are computed once **/
+	vector<face_terms> terms(numFaces);
+	vector<int> start(numVerts+1, 0);
+	parallel_for(threads, faceBlocks, [&](int b) {
+		int end = min(numFaces, (b+1)*PREPARE_BLOCK);
+		for (int i=b*PREPARE_BLOCK; i<end; i+=1) {
+			compute_face_terms(vertices, faces[i], terms[i]);
+			for (int k=0; k<3; k+=1) {
+				__sync_fetch_and_add(&start[(int)faces[i][k]+1], 1);
+			}
+		}
+	});
+
+	/** Faces around each vertex **/
+	for (int i=0; i<numVerts; i+=1) {
+		start[i+1] += start[i];
+	}
+	vector<int> cursor(start.begin(), start.end()-1);
+	vector<int> incident(3*(size_t)numFaces);
+	parallel_for(threads, faceBlocks, [&](int b) {
+		int end = min(numFaces, (b+1)*PREPARE_BLOCK);
+		for (int i=b*PREPARE_BLOCK; i<end; i+=1) {
+			for (int k=0; k<3; k+=1) {
+				incident[__sync_fetch_and_add(&cursor[(int)faces[i][k]], 1)] = i;
+			}
+		}
+	});
+
+	/** Each vertex sums its own faces in face order, so no two threads
+	 * share a vertex and the result matches the serial scatter **/
+	parallel_for(threads, vertBlocks, [&](int b) {
+		int end = min(numVerts, (b+1)*PREPARE_BLOCK);
+		for (int v=b*PREPARE_BLOCK; v<end; v+=1) {
+			int* first = incident.data() + start[v];
+			int* last = incident.data() + start[v+1];
+			sort(first, last);
+			for (int* f = first; f != last; f+=1) {
+				add_face_terms(vertices[v], terms[*f]);
+			}
+		}
+	});
+}
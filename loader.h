@@ -0,0 +1,128 @@
+#ifndef LOADER_H
+#define LOADER_H
+
+#include <cstddef>
+#include <string>
+#include "mesh.h"
+
+/********* Memory mapped input files ***********/
+
+struct mapped_file {
+	const char* data;
+	size_t size;
+	mapped_file();
+	~mapped_file();
+	bool open(const char* filename);
+	void close();
+};
+
+/********* OFF scanning primitives ***********/
+
+/* Each returns the position just after what it read, or NULL if the
+ * bytes at [p] do not hold the expected record */
+const char* skip_line(const char* p, const char* end);
+const char* scan_off_header(const char* p, const char* end, int& numVerts, int& numFaces);
+const char* scan_vertex(const char* p, const char* end, vertex& v);
+const char* scan_polygon(const char* p, const char* end, int numVerts, vector<int>& ids);
+
+/* Reads a polygon and appends its triangle fan to [tris]; [ids] is
+ * scratch space reused across calls */
+const char* scan_face(const char* p, const char* end, int numVerts, vector<int>& ids, vector<vec3>& tris);
+
+/********* Mesh file readers ***********/
+
+struct load_stats {
+	size_t bytes;              // text bytes parsed (after decompression)
+	int threads;
+	double parse_seconds;
+	bool from_cache;
+	size_t compressed_bytes;   // size of a .gz/.zst source, else 0
+	double decompress_seconds; // time the decoder spent inflating
+	load_stats();
+	double megabytes_per_second() const;
+};
+
+/* Parse the OFF file directly out of a read-only mapping of the file,
+ * without any per-line allocation. Fills [vertices] with raw positions
+ * and [faces] with vertex indices, triangulating polygons as fans;
+ * returns false if the file could not be read. With more than one
+ * thread the body is split into newline aligned chunks which are parsed
+ * in parallel. */
+bool readOFF(const char* filename, vector<vertex>& vertices, vector<vec3>& faces,
+				int threads = 1, load_stats* stats = NULL);
+
+/* Binary (little or big endian) PLY. Vertex positions and face index
+ * lists are copied out of the mapped file without text conversion, and
+ * polygons are triangulated as fans. */
+bool readPLY(const char* filename, vector<vertex>& vertices, vector<vec3>& faces,
+				int threads = 1, load_stats* stats = NULL);
+
+/* Incremental OFF parser for input that arrives in pieces. [feed] takes
+ * whole lines only; [finish] parses the final unterminated line, if
+ * any, and checks that every record was seen. Errors are reported
+ * against [filename]. */
+struct off_line_parser {
+	const char* filename;
+	vector<vertex>& vertices;
+	vector<vec3>& faces;
+	int numVerts;
+	int numFaces;
+	int record;
+	vector<int> ids;
+	off_line_parser(const char* filename, vector<vertex>& vertices, vector<vec3>& faces);
+	bool feed(const char* p, const char* end);
+	bool finish(const char* p, const char* end);
+};
+
+/* gzip (.gz) or, when built with zstd, .zst compressed OFF. A decoder
+ * thread inflates the mapped file into a few fixed size blocks while
+ * the calling thread parses the lines of the blocks already decoded, so
+ * no decompressed copy of the file is ever held or written. */
+bool readCompressedOFF(const char* filename, vector<vertex>& vertices, vector<vec3>& faces,
+				load_stats* stats = NULL);
+
+/* Picks the reader from the file extension: .gz/.zst compressed OFF,
+ * .ply, or OFF otherwise */
+bool readMeshFile(const char* filename, vector<vertex>& vertices, vector<vec3>& faces,
+				int threads = 1, load_stats* stats = NULL);
+
+/* Reference getline+stringstream reader, kept for comparison */
+bool readOFFStream(const char* filename, vector<vertex>& vertices, vector<vec3>& faces);
+
+/* Loads a prepared mesh, preferring the binary cache next to the
+ * source file ([filename].cache). On a miss the mesh file is parsed and
+ * prepared, and the cache is rewritten when [use_cache] is set. */
+bool loadMesh(const char* filename, vector<vertex>& vertices, vector<vec3>& faces,
+				int threads = 1, bool use_cache = true, load_stats* stats = NULL);
+
+/********* Binary mesh cache ***********/
+
+/* Versioned binary copy of a prepared mesh: the finished vertex array
+ * (position, normal, quadric) and the face indices, tagged with the
+ * source file's size, mtime and content hash so stale caches are
+ * rejected. */
+string cacheFilename(const char* source);
+bool readCache(const char* source, vector<vertex>& vertices, vector<vec3>& faces, int threads = 1);
+bool writeCache(const char* source, const vector<vertex>& vertices, const vector<vec3>& faces, int threads = 1);
+
+/* 64 bit content hash, computed over 1MB blocks in parallel */
+unsigned long long hashBytes(const char* data, size_t size, int threads = 1);
+
+/* The centering and scaling prepareMesh applied: a prepared position p
+ * is the original (p - middle)*scale */
+struct mesh_transform {
+	vec3 middle;
+	float scale;
+};
+
+/* Centers and rescales the model, then computes vertex normals and
+ * accumulates the per-vertex quadrics */
+void prepareMesh(vector<vertex>& vertices, vector<vec3>& faces, int threads = 1,
+				mesh_transform* transform = NULL);
+
+/* Adds the area weighted normal and the plane quadric of every face to
+ * its three vertices in one pass over the faces. Each vertex gathers its
+ * faces in index order, so the sums are identical on any thread count. */
+void accumulateNormalsAndQuadrics(vector<vertex>& vertices, vector<vec3>& faces, int threads = 1);
+
+#endif //LOADER_H
@@ -3,9 +3,17 @@
 /*************************************************************************/
 
 #include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <string>
+#include <cmath>
+#include <thread>
+#include <atomic>
 #include <GLUT/glut.h>
 #include "shaders.h"
 #include "mesh.h"
+#include "threadpool.h"
+#include "timer.h"
 
 #define BUFFER_OFFSET(i) (reinterpret_cast<void*>(i))
 
@@ -37,9 +45,20 @@ int collapseSpeed;
 int width;
 int height;
 
+/***  BACKGROUND LOADING  ***/
+enum load_stage { LOAD_READING, LOAD_BUILDING, LOAD_FAILED };
+const int NUM_LOAD_STAGES = 2;
+const char* LOAD_STAGE_NAMES[] = {"Reading", "Building half-edges"};
+atomic<int> loadStage(LOAD_READING);
+atomic<Mesh*> loadedMesh(NULL); // published by the loader, taken by display()
+thread loader;
+double loadStart;
+
 /***  SCENE PARAMETERS  ***/
 GLuint vertexshader, fragmentshader, shaderprogram ; // shaders
-Mesh* mesh;
+Mesh* mesh; // NULL until the loader thread hands the model over
+string modelFile;
+
 vec4 light_position[MAXLIGHTS]; //current position of the 10 lights
 vec4 light_specular[MAXLIGHTS]; //color of lights
 vec3 eye; 
@@ -50,7 +69,7 @@ int numLights;
 /* Forward Declaration */
 void parseConfig(const char*);
 void draw();
-Mesh* parseOFF(char*);
+bool parseOFF(const char*, int, bool, vector<vertex>&, vector<vec3>&);
 
 /* Variables to set uniform params for lighting fragment shader */
 GLuint isWire;
@@ -87,7 +106,8 @@ void printHelp() {
 			<< "use 'c' to move camera.\n"
 			<< "use 'm' to animate.\n"
 			<< "use 'up' or 'down' arrows to change level of detail.\n"
-			<< "use 'left' or 'right' arrows to change rate of collapse"
+			<< "use 'left' or 'right' arrows to change rate of collapse\n"
+			<< "press 'o' to save the progressive mesh.\n"
 			<< "use '1-9' to move lights.\n"
 			<< "press ESC to quit.\n\n";	
 }
@@ -154,6 +174,7 @@ void keyboard(unsigned char key, int x, int y) {
 		//mesh->debug();
 		break;
 	case 27:  // Escape to quit
+		if (loader.joinable()) loader.detach();
 		delete mesh;
 		exit(0);
 		break;
@@ -179,6 +200,14 @@ void keyboard(unsigned char key, int x, int y) {
 		cameraYaw=0;
 		cout << "Camera rotation is now set to" << (cameraMode ? " true " : " false ") << "\n";
 		break;
+	case 'o': {
+		if (!mesh) break;
+		string pmFile = modelFile + ".pm";
+		if (mesh->write_progressive(pmFile.c_str())) {
+			cout << "Saved progressive mesh to " << pmFile << "\n";
+		}
+		break;
+	}
 	case 'm':
 		animate = !animate;
 		lastTime = glutGet(GLUT_ELAPSED_TIME);
@@ -213,6 +242,7 @@ void keyboard(unsigned char key, int x, int y) {
 }
 
 void specialKey(int key,int x,int y) {
+	if (!mesh) return;
 	switch(key) {
 		case 100: //left
 			if (collapseSpeed != 1){
@@ -239,8 +269,98 @@ void specialKey(int key,int x,int y) {
 }
 
 
-void init(char* filename) {
-	mesh = parseOFF(filename);
+bool hasSuffix(const string& str, const string& suffix) {
+	return str.size() >= suffix.size() &&
+		str.compare(str.size()-suffix.size(), suffix.size(), suffix) == 0;
+}
+
+/** Background loading. The loader thread reads the model and builds the
+ * half-edges and queue while the window keeps drawing a progress bar;
+ * the finished Mesh is published through [loadedMesh] and display()
+ * takes it over and creates its GL buffers. **/
+
+
+void loadModel(string filename, int threads, bool use_cache) {
+	Mesh* m = NULL;
+	if (hasSuffix(filename, ".pm")) {
+		m = Mesh::read_progressive(filename.c_str());
+	} else {
+		vector<vertex> vertices;
+		vector<vec3> faces;
+		if (parseOFF(filename.c_str(), threads, use_cache, vertices, faces)) {
+			loadStage = LOAD_BUILDING;
+			m = new Mesh(vertices, faces, threads);
+		}
+	}
+	if (m) {
+		loadedMesh.store(m, memory_order_release);
+	} else {
+		loadStage = LOAD_FAILED;
+	}
+}
+
+/* Takes over the loaded mesh, if it is ready */
+void pollLoader() {
+	Mesh* m = loadedMesh.exchange(NULL, memory_order_acquire);
+	if (m) {
+		loader.join();
+		mesh = m;
+		mesh->init_buffers();
+		glutSetWindowTitle("Mesh Viewer");
+		cout << "Model ready after " << (wall_time()-loadStart)*1000 << " ms" << endl;
+	} else if (loadStage == LOAD_FAILED) {
+		loader.join();
+		exit(1);
+	}
+}
+
+/* Bar across the bottom of the window: one segment per finished stage
+ * and a block sweeping through the current one */
+void drawProgress() {
+	int stage = loadStage;
+	float seconds = wall_time() - loadStart;
+	char title[256];
+	snprintf(title, sizeof(title), "Mesh Viewer - %s %s (%.1f s)",
+			 LOAD_STAGE_NAMES[stage], modelFile.c_str(), seconds);
+	glutSetWindowTitle(title);
+
+	glUseProgram(0);
+	glMatrixMode(GL_PROJECTION);
+	glPushMatrix();
+	glLoadIdentity();
+	glOrtho(0, 1, 0, 1, -1, 1);
+	glMatrixMode(GL_MODELVIEW);
+	glLoadIdentity();
+	glDisable(GL_DEPTH_TEST);
+
+	float left = 0.1, right = 0.9, bottom = 0.08, top = 0.11;
+	float done = left + (right-left)*stage/NUM_LOAD_STAGES;
+	float segment = (right-left)/NUM_LOAD_STAGES;
+	float sweep = done + segment*(seconds - floor(seconds));
+	glBegin(GL_QUADS);
+	glColor3f(0.2, 0.2, 0.2);
+	glVertex2f(left, bottom); glVertex2f(right, bottom); glVertex2f(right, top); glVertex2f(left, top);
+	glColor3f(1, 1, 1);
+	glVertex2f(left, bottom); glVertex2f(done, bottom); glVertex2f(done, top); glVertex2f(left, top);
+	glColor3f(0.7, 0.7, 0.7);
+	glVertex2f(done, bottom); glVertex2f(sweep, bottom); glVertex2f(sweep, top); glVertex2f(done, top);
+	glEnd();
+
+	glEnable(GL_DEPTH_TEST);
+	glMatrixMode(GL_PROJECTION);
+	glPopMatrix();
+	glMatrixMode(GL_MODELVIEW);
+	glUseProgram(shaderprogram);
+}
+
+void init(char* filename, int threads, bool use_cache) {
+	modelFile = filename;
+	mesh = NULL;
+	loadStart = wall_time();
+	loader = thread(loadModel, modelFile, threads, use_cache);
+	if (hasSuffix(modelFile, ".pm")) {
+		modelFile.erase(modelFile.size()-3);
+	}
 	/* Default Values */
 	eye = vec3(0,0,-10);
 	trans = vec3(0,0,0);
@@ -301,12 +421,25 @@ vec3 direction(float &yaw, float &pitch, const vec3& dir) {
 
 /* main display */
 void display() {
+	if (!mesh) {
+		pollLoader();
+	}
 	if (useWire){
 		glClearColor(0,0,0,0);
 	} else {
 		glClearColor(135/225.0, 206/255.0, 250/255.0, 0);
 	}
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	if (!mesh) {
+		drawProgress();
+		glutSwapBuffers();
+		static bool first = true;
+		if (first) {
+			cout << "First frame after " << (wall_time()-loadStart)*1000 << " ms" << endl;
+			first = false;
+		}
+		return;
+	}
 	glMatrixMode(GL_MODELVIEW);
 	
 	mat4 mv;
@@ -348,14 +481,26 @@ void display() {
 }
 
 int main(int argc, char* argv[]) {
-	if (argc != 2) {
-		std::cerr << "You need a mesh file as an argument\n";
+	glutInit(&argc, argv);
+	char* filename = NULL;
+	int threads = hardware_threads();
+	bool use_cache = true;
+	for (int i=1; i<argc; i+=1) {
+		if (!strcmp(argv[i], "-j") && i+1 < argc) {
+			threads = max(1, atoi(argv[++i]));
+		} else if (!strcmp(argv[i], "-nocache")) {
+			use_cache = false;
+		} else {
+			filename = argv[i];
+		}
+	}
+	if (!filename) {
+		std::cerr << "usage: viewer [-j threads] [-nocache] <mesh.off | mesh.pm>\n";
 		exit(1);
 	}
-	glutInit(&argc, argv);
 	glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGBA | GLUT_DEPTH);
 	glutCreateWindow("Mesh Viewer");
-	init(argv[1]);
+	init(filename, threads, use_cache);
 	glutDisplayFunc(display);
 	glutKeyboardFunc(keyboard);
 	glutSpecialFunc(specialKey);
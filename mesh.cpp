@@ -1,89 +1,132 @@
+#include <cstdio>
+#include <cstdint>
+#include <algorithm>
 #include "mesh.h"
+#include "pairing.h"
+#include "threadpool.h"
 using namespace std;
 
 const float THRESHOLD = 100;
+const float LOCKED_COST = 1e30f; // above THRESHOLD, so never collapsed
+const int COST_BLOCK = 16384;     // edges evaluated per task while building
+const int ROUND_SHARE = 64;       // a parallel round looks at 1/64 of the queue
+const int ROUND_CHUNK = 64;       // edges collapsed per task in a round
 
-Mesh::Mesh(vector<vertex>& vertices, vector<vec3>& faces) {
+Mesh::Mesh(vector<vertex>& vertices, vector<vec3>& faces, int threads, quadric_precision precision)
+	: round_stamp(0), in_round(false), sampled(false), precision(precision), lazy(false), pq(edge_compare(&merge_costs)) {
 
 	unsigned int numFaces = faces.size();
 	numIndices = numFaces*3;
 	max_lod = -1;
-  
-	existing_edges = boost::unordered_map< pair<int, int>, half_edge* >();
+	live_faces = numFaces;
 	level_of_detail = 0;
 	
 	for (int i=0; i<vertices.size(); i+=1){
 		verts.push_back(vertices[i]);
 	}
 	
-	vector<edge_data*> edatas;
+	/** find the symmetric edge of every half edge */
+	vector<int> sym, owner;
+	pairHalfEdges(faces, sym, owner, threads);
 
-  for (unsigned int i=0; i < numFaces; i+=1) {
-	int v0 = faces[i][0];
-	int v1 = faces[i][1];
-	int v2 = faces[i][2];
-	
-	half_edge* e0 = new half_edge();
-	half_edge* e1 = new half_edge();
-	half_edge* e2 = new half_edge();
-	
-	e0->v = v0;
-	e1->v = v1;
-	e2->v = v2;
-
-	/** populate next/prev edges for each edge in this face */
-	e0->prev = e2;
-	e0->next = e1;
-	e1->prev = e0;
-	e1->next = e2;
-	e2->prev = e1;
-	e2->next = e0;
-	
-	/** populate the symmetric edge for the given edge */
-	populate_symmetric_edge(e0, v0, v1, edatas);
-	populate_symmetric_edge(e1, v1, v2, edatas);
-	populate_symmetric_edge(e2, v2, v0, edatas);
-
-	/** add edges to vector */
-	e0->index = edges.size();
-	edges.push_back(e0);
-	e1->index = edges.size();
-	edges.push_back(e1);
-	e2->index = edges.size();
-	edges.push_back(e2);
-  }
-	
-	for(int i=0; i<edatas.size(); i+=1){
-		edge_data* d = edatas[i];
-		d->calculate_quad_error(verts);
-		d->pq_handle = pq.push(d);
+	edges.resize(numIndices);
+	removed.assign(numFaces, false);
+	for (unsigned int i=0; i < numIndices; i+=1) {
+		half_edge& e = edges[i];
+		e.v = faces[i/3][i%3];
+		e.sym = sym[i];
+
+		/** the first half edge of each edge numbers its record */
+		if (owner[i] == i) {
+			e.edge = edge_halves.size();
+			edge_halves.push_back(i);
+		} else {
+			e.edge = edges[owner[i]].edge;
+		}
 	}
 
-  glGenBuffers(1, &arrayBuffer);
-  glGenBuffers(1, &elementArrayBuffer);
-  update_buffer();
-}
+	/** anchor each vertex at a boundary half-edge when it has one */
+	anchor.assign(verts.size(), -1);
+	for (unsigned int i=0; i < numIndices; i+=1) {
+		int& a = anchor[edges[i].v];
+		if (a < 0 || (edges[i].sym < 0 && edges[a].sym >= 0)) {
+			a = i;
+		}
+	}
+	boundary.assign(verts.size(), false);
+	for (int v=0; v<verts.size(); v+=1) {
+		boundary[v] = anchor[v] >= 0 && edges[anchor[v]].sym < 0;
+	}
+	if (precision == DOUBLE_QUADRICS) {
+		accumulate_double_quadrics();
+	}
 
-Mesh::~Mesh(){
-	vector<half_edge*>::iterator it;
-	for (it=edges.begin(); it!=edges.end(); ++it) {
-		delete *it;
+	int numEdges = edge_halves.size();
+	merge_points.resize(numEdges);
+	merge_costs.resize(numEdges);
+	pq_handles.resize(numEdges);
+	retired.assign(numEdges, false);
+	stale.assign(numEdges, false);
+	blocked.assign(numEdges, false);
+	vector<int> ids(numEdges);
+	for (int e=0; e<numEdges; e+=1) {
+		ids[e] = e;
+	}
+	/* Blocks of edges are evaluated in parallel; costs depend on nothing
+	 * but the edge, so any thread count gives the same queue */
+	parallel_for(threads, (numEdges+COST_BLOCK-1)/COST_BLOCK, [&](int b) {
+		int start = b*COST_BLOCK;
+		calculate_quad_errors(&ids[start], min(numEdges-start, COST_BLOCK));
+	});
+#ifdef BINOMIAL_QUEUE
+	for (int e=0; e<numEdges; e+=1) {
+		pq_handles[e] = pq.push(e);
 	}
-	while(!pq.empty()){
-		delete pq.top();
-		pq.pop();
+#else
+	pq.assign(numEdges);
+	for (int e=0; e<numEdges; e+=1) {
+		pq_handles[e] = e;
+	}
+#endif
+}
+
+/* The plane quadrics of every face summed per vertex in double, as
+ * accumulateNormalsAndQuadrics does in float */
+void
+Mesh::accumulate_double_quadrics() {
+	double_quadrics.assign(verts.size(), quadric_d());
+	for (unsigned int i=0; i < numIndices; i+=3) {
+		glm::dvec3 v0 = glm::dvec3(verts[edges[i].v].position);
+		glm::dvec3 v1 = glm::dvec3(verts[edges[i+1].v].position);
+		glm::dvec3 v2 = glm::dvec3(verts[edges[i+2].v].position);
+		glm::dvec3 norm = glm::normalize(glm::cross(v1-v0, v2-v0));
+		quadric_d Q(glm::dvec4(norm, -glm::dot(norm, v0)));
+		for (int k=0; k<3; k+=1) {
+			double_quadrics[edges[i+k].v] += Q;
+		}
 	}
 }
 
+/* Empty mesh, filled in by read_progressive */
+Mesh::Mesh() : round_stamp(0), in_round(false), sampled(false), precision(FLOAT_QUADRICS), lazy(false), pq(edge_compare(&merge_costs)) {
+	numIndices = 0;
+	level_of_detail = 0;
+	max_lod = -1;
+	live_faces = 0;
+}
+
+Mesh::~Mesh(){
+}
+
 void
 Mesh::debug() {
 	cout << "******************" << endl;
 	for (int i=0; i<edges.size(); i+=3){
-		if (!edges[i]) continue;
+		if (removed[i/3]) continue;
 		cout << "Face " << i/3 <<":  ";
-		cout << edges[i]->v << "  ";
-		cout << edges[i+1]->v << "  ";
-		cout << edges[i+2]->v << "  ";
+		cout << edges[i].v << "  ";
+		cout << edges[i+1].v << "  ";
+		cout << edges[i+2].v << "  ";
 		cout << endl;
 	}
 	cout << endl;
@@ -92,103 +135,274 @@ Mesh::debug() {
 
 /** Half Edge functions **/
 
+/* Where edge [id] may merge: the point it has to stay at when it
+ * touches the boundary, else the midpoint to fall back on if its
+ * quadric is singular */
 void
-edge_data::calculate_quad_error(vector<vertex>& verts) {
-	float Q1[10];
-	float Q2[10];
-	
-	memcpy(Q1, verts[edge->v].Q, sizeof(Q1));
-	memcpy(Q2, verts[edge->next->v].Q, sizeof(Q2));
-	
-	for (int i=0; i<10; i+=1) {
-		Q1[i] += Q2[i];
-	}
-	/** Hard coded solution to minimum quadric error **/
-	float a = Q1[0];
-	float b = Q1[1];
-	float c = Q1[2];
-	float d = Q1[3];
-	float e = Q1[4];
-	float f = Q1[5];
-	float g = Q1[6];
-	float h = Q1[7];
-	float i = Q1[8];
-	
-	float det = a*e*h - a*f*f - b*b*h + 2*b*c*f - c*c*e;
-	
+Mesh::merge_target(int id, edge_target& t) const {
+	int edge = edge_halves[id];
+	int esym = edges[edge].sym;
+	t.v1 = edges[edge].v;
+	t.v2 = edges[next_edge(edge)].v;
+	const vertex& p1 = verts[t.v1];
+	const vertex& p2 = verts[t.v2];
+
 	/* Check if one of the ends of the edge is on the edge of the mesh */
-	half_edge* curEdge = edge;
-	
-	bool firstEdge = false;
-	do {
-		if (!curEdge->prev->sym){
-			firstEdge = true;
-			break;
-		}
-		curEdge = curEdge->prev->sym;
-	} while(curEdge != edge);
-	
-	bool secondEdge = false;
-	if(edge->sym){
-		curEdge = edge->sym;
-		do {
-			if (!curEdge->prev->sym){
-				secondEdge = true;
-				break;
-			}
-			curEdge = curEdge->prev->sym;
-		} while(curEdge != edge->sym);
-	}
-	
-	float x,y,z;
-	float multiplier = 1;
-	if (!edge->sym) {
-		merge_point = (verts[edge->v].position + verts[edge->next->v].position)/2.0f;
-		x = merge_point[0];
-		y = merge_point[1];
-		z = merge_point[2];
-		multiplier = 3.0;
+	bool firstEdge = boundary[t.v1];
+	bool secondEdge = esym >= 0 && boundary[edges[esym].v];
+
+	t.free = false;
+	t.multiplier = 2.0;
+	if (esym < 0) {
+		t.fixed = (p1.position + p2.position)/2.0f;
+		t.multiplier = 3.0;
 	} else if (firstEdge) {
-		merge_point = verts[edge->v].position;
-		x = merge_point[0];
-		y = merge_point[1];
-		z = merge_point[2];
-		multiplier = 2.0;
+		t.fixed = p1.position;
 	} else if (secondEdge) {
-		merge_point = verts[edge->next->v].position;
-		x = merge_point[0];
-		y = merge_point[1];
-		z = merge_point[2];
-		multiplier = 2.0;
-	} else if (det<0.01) {
-		merge_point = (verts[edge->v].position + verts[edge->next->v].position)/2.0f;
-		x = merge_point[0];
-		y = merge_point[1];
-		z = merge_point[2];
+		t.fixed = p2.position;
 	} else {
-		x = d*f*f - c*g*f - b*i*f - d*e*h + b*g*h + c*e*i;
-		x /= det;
-		y = g*c*c - d*f*c - b*i*c + b*d*h - a*g*h + a*f*i;
-		y /= det;
-		z = i*b*b - d*f*b - c*g*b + c*d*e + a*f*g - a*e*i;
-		z /= det;
-		merge_point = vec3(x,y,z);
-	}
-	merge_cost = a*x*x + 2*b*x*y + 2*c*x*z + 2*d*x + e*y*y
-						+ 2*f*y*z + 2*g*y + h*z*z + 2*i*z + Q1[9];
-						
-	merge_cost = abs(merge_cost) * multiplier;
-	merge_cost += (rand()%100000)/1000000000.0f; // jitter
+		t.fixed = (p1.position + p2.position)/2.0f;
+		t.multiplier = 1;
+		t.free = true;
+	}
+	t.penalty = firstEdge && secondEdge;
+	t.locked = p1.locked || p2.locked;
+}
+
+/* Breaks ties between equal costs: up to 1e-4, from a hash of the two
+ * vertex ids, so it depends neither on the order edges are evaluated in
+ * nor on state shared between threads */
+static float
+jitter(int v1, int v2) {
+	uint64_t key = (uint64_t)(uint32_t)min(v1, v2) << 32 | (uint32_t)max(v1, v2);
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdULL;
+	key ^= key >> 33;
+	key *= 0xc4ceb9fe1a85ec53ULL;
+	key ^= key >> 33;
+	return (key % 100000)/1000000000.0f;
+}
+
+/* Turns the quadric error of an edge into its queue key */
+static float
+finish_cost(const edge_target& t, float error) {
+	float merge_cost = abs(error) * t.multiplier;
+	merge_cost += jitter(t.v1, t.v2);
 	
-	if (firstEdge && secondEdge) {
+	if (t.penalty) {
 		merge_cost += 10; //collapse this case near the end
 	}
+	if (t.locked) {
+		merge_cost = LOCKED_COST;
+	}
+	return merge_cost;
 }
 
-bool
-edge_compare::operator() (const edge_data* he1, const edge_data* he2) const
-{
-	return he1->merge_cost > he2->merge_cost;
+/* Sum of the quadrics of two vertices, in S */
+template <class S>
+basic_quadric<S>
+Mesh::edge_quadric(int v1, int v2) const {
+	if (!double_quadrics.empty()) {
+		return basic_quadric<S>(double_quadrics[v1] + double_quadrics[v2]);
+	}
+	return basic_quadric<S>(verts[v1].Q) + basic_quadric<S>(verts[v2].Q);
+}
+
+template <class S>
+void
+Mesh::evaluate_edge(int id) {
+	typedef typename basic_quadric<S>::point point;
+	edge_target t;
+	merge_target(id, t);
+	basic_quadric<S> Q = edge_quadric<S>(t.v1, t.v2);
+
+	point best = point(t.fixed);
+	if (t.free && Q.solve(best) < QUADRIC_MIN_DET) {
+		best = point(t.fixed);
+	}
+	merge_points[id] = vec3(best);
+	merge_costs[id] = finish_cost(t, Q.evaluate(best));
+}
+
+void
+Mesh::calculate_quad_error(int id) {
+	if (precision == FLOAT_QUADRICS) {
+		evaluate_edge<float>(id);
+	} else {
+		evaluate_edge<double>(id);
+	}
+}
+
+/* calculate_quad_error for each of the [n] edges in [ids], in order:
+ * the endpoint quadrics of QUADRIC_BATCH edges are gathered into a
+ * batch and solved and evaluated a vector register at a time */
+template <class S>
+void
+Mesh::evaluate_edges(const int* ids, int n) {
+	basic_quadric_batch<S> batch;
+	edge_target t[QUADRIC_BATCH];
+	for (int start=0; start<n; start+=QUADRIC_BATCH) {
+		int count = min(n-start, QUADRIC_BATCH);
+		for (int i=0; i<count; i+=1) {
+			merge_target(ids[start+i], t[i]);
+			if (double_quadrics.empty()) {
+				batch.set(i, verts[t[i].v1].Q, verts[t[i].v2].Q, t[i].fixed, t[i].free);
+			} else {
+				batch.set(i, double_quadrics[t[i].v1], double_quadrics[t[i].v2], t[i].fixed, t[i].free);
+			}
+		}
+		batch.evaluate(count);
+		for (int i=0; i<count; i+=1) {
+			int id = ids[start+i];
+			merge_points[id] = batch.merge_point(i);
+			merge_costs[id] = finish_cost(t[i], batch.cost[i]);
+		}
+	}
+}
+
+void
+Mesh::calculate_quad_errors(const int* ids, int n) {
+	if (precision == FLOAT_QUADRICS) {
+		evaluate_edges<float>(ids, n);
+	} else {
+		evaluate_edges<double>(ids, n);
+	}
+}
+
+/* Takes edge [e] out of the queue (or the pool) for good. Inside a
+ * parallel round the queue is left alone and the removal logged. */
+void
+Mesh::retire_edge(int e) {
+	blocked[e] = false;
+	if (retired[e]) return;
+	retired[e] = true;
+	if (in_round) {
+		lock_guard<mutex> guard(round_lock);
+		round_ops.push_back(e);
+		return;
+	}
+	if (sampled) {
+		pool.erase(e);
+		return;
+	}
+	pq.erase(pq_handles[e]);
+	stats.heap_ops += 1;
+}
+
+/* Puts a popped edge back in the queue (or the pool) */
+void
+Mesh::requeue_edge(int e) {
+	retired[e] = false;
+	blocked[e] = false;
+	if (in_round) {
+		lock_guard<mutex> guard(round_lock);
+		round_ops.push_back(~e);
+		return;
+	}
+	if (sampled) {
+		pool.insert(e);
+		return;
+	}
+	pq_handles[e] = pq.push(e);
+	stats.heap_ops += 1;
+}
+
+/* Re-evaluates edge [e] after one of its ends moved */
+void
+Mesh::update_edge(int e) {
+	calculate_quad_error(e);
+	if (!retired[e] && !sampled) {
+		pq.update(pq_handles[e]);
+	}
+}
+
+/* update_edge for every edge in [s.touched_edges], evaluated as one
+ * batch; blocked edges among them go back in the queue. A lazy mesh
+ * evaluates only those and the edges touching the boundary, whose merge
+ * point moves with their ends; the others are marked stale and stay
+ * where they are in the queue. */
+void
+Mesh::update_edges(collapse_scratch& s) {
+	evaluate_touched(s);
+	apply_touched(s);
+}
+
+/* The first half of update_edges, which leaves the queue alone: the
+ * edges to evaluate are added to [s.eager_edges] and their new costs to
+ * [s.fresh_costs], while merge_costs keeps the keys they are queued by.
+ * Touches only the touched edges, so tasks whose edges are apart can
+ * run it side by side. */
+void
+Mesh::evaluate_touched(collapse_scratch& s) {
+	const vector<int>& ids = s.touched_edges;
+	int first = s.eager_edges.size();
+	for (int i=0; i<ids.size(); i+=1) {
+		int e = ids[i];
+		if (lazy) {
+			if (retired[e] && !blocked[e]) continue;
+			int h = edge_halves[e];
+			if (!blocked[e] && !boundary[edges[h].v] && !boundary[edges[next_edge(h)].v]) {
+				stale[e] = true;
+				continue;
+			}
+			stale[e] = false;
+		}
+		s.eager_edges.push_back(e);
+	}
+	int n = s.eager_edges.size()-first;
+	s.fresh_costs.resize(first+n);
+	if (n == 0) return;
+	const int* batch = &s.eager_edges[first];
+	float* fresh = &s.fresh_costs[first];
+
+	/* The queue can restore its order around one changed key at a time,
+	 * so the keys it holds go back in and the new costs are applied one
+	 * by one */
+	for (int i=0; i<n; i+=1) {
+		fresh[i] = merge_costs[batch[i]];
+	}
+	calculate_quad_errors(batch, n);
+	for (int i=0; i<n; i+=1) {
+		swap(fresh[i], merge_costs[batch[i]]);
+	}
+}
+
+/* The second half of update_edges: the new costs into the queue */
+void
+Mesh::apply_touched(collapse_scratch& s) {
+	const vector<int>& batch = s.eager_edges;
+	int n = batch.size();
+	stats.evaluations += n;
+	for (int i=0; i<n; i+=1) {
+		merge_costs[batch[i]] = s.fresh_costs[i];
+		if (blocked[batch[i]]) {
+			requeue_edge(batch[i]);
+		} else if (!retired[batch[i]] && !sampled) {
+			pq.update(pq_handles[batch[i]]);
+			stats.heap_ops += 1;
+		}
+	}
+	s.eager_edges.clear();
+	s.fresh_costs.clear();
+}
+
+/* The cheapest edge in the queue, or -1 when it is empty. A stale edge
+ * on top is evaluated; if its cost is not its key it is moved to where
+ * the cost belongs and the new top is tried. */
+int
+Mesh::top_edge() {
+	while (!pq.empty()) {
+		int e = pq.top();
+		if (!stale[e]) return e;
+		float key = merge_costs[e];
+		calculate_quad_error(e);
+		stale[e] = false;
+		stats.evaluations += 1;
+		if (merge_costs[e] == key) return e;
+		pq.update(pq_handles[e]);
+		stats.heap_ops += 1;
+	}
+	return -1;
 }
 
 bool
@@ -201,18 +415,16 @@ operator==(const glm::vec3 &vecA, const glm::vec3 &vecB){
 
 /** Vertex functions **/
 
-vertex::vertex(){};
+vertex::vertex() : locked(false) {};
 
 vertex::vertex(float x, float y, float z) {
 	position = vec3(x,y,z);
 	normal = vec3(0.0f,0.0f,0.0f);
-	for (int i=0; i<10; i+=1){
-		Q[i] = 0;
-	}
+	locked = false;
 }
 
 vertex::vertex(vertex* v) {
-	memcpy(&position, v, sizeof(vertex));
+	*this = *v;
 }
 
 vertex_data vertex::data() {
@@ -222,296 +434,291 @@ vertex_data vertex::data() {
 }
 
 
-/** Given a half_edge [e] and its two defining vertices [v0,v1], we check if
- * the pair [v0,v1] already exists in the existing_edges map, where v0 < v1.
- * If it doesn't exist, we set the value in the map to be our current edge*,
- * else we set [e]'s symmetric edge to be the value in the map and the map's
- * symmetric edge to be [e]. Also puts edge in priority queue and calculates
- * the removal priority
- * => Returns true if the value was found in the map.
- */
-void
-Mesh::populate_symmetric_edge(half_edge* e, int v0, int v1, vector<edge_data*>& edatas) {
-	pair<int, int> key = get_vertex_key(v0, v1);
-	boost::unordered_map< pair<int, int>, half_edge* >::iterator it = 
-		existing_edges.find(key);
-	if (it != existing_edges.end() ) { // exists
-		e->sym = it->second;
-		e->sym->sym = e;
-		e->data = e->sym->data;
-	} else {
-		existing_edges[key] = e;
-		e->sym = NULL; 
-		edge_data* d = new edge_data();
-		d->edge = e;
-		e->data = d;
-		edatas.push_back(d);
+/* First half-edge of the fan around the start of [h]: the one with no
+ * twin when the fan is open, else [h] itself */
+int
+Mesh::fan_start(int h) const {
+	int start = h;
+	for (size_t steps=0; edges[h].sym >= 0 && steps < edges.size(); steps+=1) {
+		h = next_edge(edges[h].sym);
+		if (h == start) break;
 	}
+	return h;
 }
 
-pair<int, int>
-Mesh::get_vertex_key(int v0, int v1) {
-   if (v0 < v1) 
-	 return pair<int, int> (v0, v1);
-   else
-	 return pair<int, int> (v1, v0);
+/* Points the anchor of [v] at the start of the fan through [h], one of
+ * its outgoing half-edges, and refreshes its boundary bit. Called for
+ * every vertex whose twins a collapse, fin or degenerate face changes */
+void
+Mesh::anchor_vertex(int v, int h) {
+	if (h < 0 || removed[h/3]) return;
+	anchor[v] = fan_start(h);
+	boundary[v] = edges[anchor[v]].sym < 0;
 }
 
+/* Appends the half-edges leaving [v] to [res], sweeping the fan from
+ * the anchor. [h] leaves [v]; if the anchor is in another fan of a
+ * non-manifold vertex, the fan of [h] is swept instead. */
 void
-Mesh::get_src_edges(vector<half_edge*> &res, half_edge* he) {
-	if (he->sym == NULL && he->prev->sym == NULL) return;
-	half_edge* loop;
-	if (he->sym == NULL) {
-		loop = he->prev->sym;
-		while (loop && loop != he->prev) {
-			res.push_back(loop);
-			loop = loop->prev->sym;
-		}
-	} else if (he->prev->sym == NULL) {
-		loop = he->sym;
-		while (loop) {
-			res.push_back(loop->next);
-			loop = loop->next->sym;
-		}
-	} else {
-		loop = he->prev->sym;
-		while (loop != he && loop) {
-			res.push_back(loop);
-			loop = loop->prev->sym;
-		}
-        if (loop) return; //else...
-        loop = he->sym;
-        while (loop && loop != he) {
-            res.push_back(loop->next);
-            loop = loop->next->sym;
-        }
+Mesh::get_ring(vector<int> &res, int v, int h) {
+	size_t first = res.size();
+	bool found = false;
+	for (ring_circulator it(edges, anchor[v]); !it.done(); ++it) {
+		res.push_back(*it);
+		found = found || *it == h;
+	}
+	if (found) return;
+	res.resize(first);
+	for (ring_circulator it(edges, fan_start(h)); !it.done(); ++it) {
+		res.push_back(*it);
 	}
 }
 
 void
-Mesh::get_dst_edges(vector<half_edge*> &res, half_edge* he) {
-	if (he->sym == NULL && he->next->sym == NULL) return;
-	half_edge* loop;
-	if (he->sym == NULL) {
-		loop = he->next->sym;
-		while (loop && loop != he) {
-			res.push_back(loop->next);
-			loop = loop->next->sym;
-		}
-	} else if (he->next->sym == NULL) {
-		loop = he->sym;
-		while (loop && loop != he->next) {
-			res.push_back(loop);
-			loop = loop->prev->sym;
-		}
-	} else {
-		loop = he->sym;
-		while (loop != he->next && loop) {
-			res.push_back(loop);
-			loop = loop->prev->sym;
-		}
-        if (loop) return; //else...
-        loop = he->next->sym;
-        while (loop && loop != he->next) {
-            res.push_back(loop->next);
-            loop = loop->next->sym;
-        }
-	}
+Mesh::get_src_edges(vector<int> &res, int he) {
+	get_ring(res, edges[he].v, he);
 }
 
 void
-Mesh::get_neighboring_edges(vector<half_edge*> &res, half_edge* he) {
-	bool done = false;
-	half_edge* loop;
+Mesh::get_dst_edges(vector<int> &res, int he) {
+	get_ring(res, edges[next_edge(he)].v, next_edge(he));
+}
 
+void
+Mesh::get_neighboring_edges(vector<int> &res, int he) {
 	get_src_edges(res, he);
 	get_dst_edges(res, he);
 }
 
+/* True when edge [e] merges into a new vertex rather than one of its
+ * ends */
+bool
+Mesh::needs_vertex(int e) const {
+	int he = edge_halves[e];
+	return !(merge_points[e] == verts[edges[he].v].position)
+		&& !(merge_points[e] == verts[edges[next_edge(he)].v].position);
+}
+
+/* Merges the ends of [e] into its merge point: one of the ends, or a
+ * new vertex, appended or written to [slot] when one was set aside */
 void
-Mesh::calculate_new_vertex(edge_collapse& ec, edge_data* edata, half_edge* he, half_edge* hesym) {
+Mesh::calculate_new_vertex(edge_collapse& ec, int e, int he, int hesym, int slot) {
+	int v1 = edges[he].v;
+	int v2 = edges[next_edge(he)].v;
 
-	float Q1[10];
-	memcpy(Q1, verts[he->v].Q, sizeof(Q1));
-	for (int j=0; j<10; j+=1) {
-		Q1[j] += verts[he->next->v].Q[j];
+	quadric Q = verts[v1].Q + verts[v2].Q;
+	quadric_d Qd;
+	if (!double_quadrics.empty()) {
+		Qd = double_quadrics[v1] + double_quadrics[v2];
 	}
-	
-    if (edata->merge_point == verts[he->v].position){
-    	ec.collapseVert = he->v;
-    	memcpy(verts[he->v].Q, Q1, sizeof(Q1));
-    } else if (edata->merge_point == verts[he->next->v].position){
-    	ec.collapseVert= he->next->v;
-    	memcpy(verts[he->next->v].Q, Q1, sizeof(Q1));
+
+    if (merge_points[e] == verts[v1].position){
+    	ec.collapseVert = v1;
+    	verts[v1].Q = Q;
+    } else if (merge_points[e] == verts[v2].position){
+    	ec.collapseVert= v2;
+    	verts[v2].Q = Q;
     } else {
 		vertex midpoint = vertex();
-		memcpy(midpoint.Q, Q1, sizeof(Q1));
-		midpoint.position = edata->merge_point;
-		midpoint.normal = glm::normalize(verts[he->v].normal + verts[he->next->v].normal);
-		verts.push_back(midpoint);
-		ec.collapseVert = verts.size()-1;
+		midpoint.Q = Q;
+		midpoint.position = merge_points[e];
+		midpoint.normal = glm::normalize(verts[v1].normal + verts[v2].normal);
+		if (slot < 0) {
+			slot = verts.size();
+			verts.push_back(midpoint);
+			anchor.push_back(-1);
+			boundary.push_back(false);
+			if (!double_quadrics.empty()) {
+				double_quadrics.push_back(quadric_d());
+			}
+		} else {
+			verts[slot] = midpoint;
+		}
+		ec.collapseVert = slot;
 	}
-	
-	ec.removed.push_back(he->prev);
-	ec.removed.push_back(he->next);
+	if (!double_quadrics.empty()) {
+		double_quadrics[ec.collapseVert] = Qd;
+	}
+
+	ec.removed.push_back(prev_edge(he));
+	ec.removed.push_back(next_edge(he));
 	ec.removed.push_back(he);
-	edges[he->prev->index] = NULL;
-	edges[he->next->index] = NULL;
-	edges[he->index] = NULL;
-	if (hesym){
-		edges[hesym->prev->index] = NULL;
-		edges[hesym->next->index] = NULL;
-		edges[hesym->index] = NULL;
-		ec.removed.push_back(hesym->prev);
-		ec.removed.push_back(hesym->next);
+	removed[he/3] = true;
+	if (hesym >= 0){
+		removed[hesym/3] = true;
+		ec.removed.push_back(prev_edge(hesym));
+		ec.removed.push_back(next_edge(hesym));
 		ec.removed.push_back(hesym);
 	}
 }
 
+/* Joins the two edges left over when the face of [he] is removed */
 void
-Mesh::update_edge_pointers(half_edge* he, half_edge* hesym) {	
-	half_edge *first, *second;
-	edge_data *newdata;
-	
-	pq.erase(he->prev->data->pq_handle);
-	delete he->prev->data;
-	newdata = he->next->data;
-	
-	first = he->next->sym;
-	second = he->prev->sym;
-	if (first) {
-		first->sym = second;
-		first->data = newdata;
-		newdata->edge = first;
-	}
-	if (second) {
-		second->sym = first;
-		second->data = newdata;
-		newdata->edge = second;
+Mesh::update_edge_pointers(int he, int hesym) {
+	int first, second;
+	int newedge;
+
+	retire_edge(edges[prev_edge(he)].edge);
+	newedge = edges[next_edge(he)].edge;
+
+	first = edges[next_edge(he)].sym;
+	second = edges[prev_edge(he)].sym;
+	if (first >= 0) {
+		edges[first].sym = second;
+		edges[first].edge = newedge;
+		edge_halves[newedge] = first;
 	}
-	
-	if (hesym){
-		pq.erase(hesym->prev->data->pq_handle);
-		delete hesym->prev->data;
-		newdata = hesym->next->data;
+	if (second >= 0) {
+		edges[second].sym = first;
+		edges[second].edge = newedge;
+		edge_halves[newedge] = second;
+	}
+
+	if (hesym >= 0){
+		retire_edge(edges[prev_edge(hesym)].edge);
+		newedge = edges[next_edge(hesym)].edge;
 
-		first = hesym->next->sym;
-		second = hesym->prev->sym;
-		if (first) {
-			first->sym = second;
-			first->data = newdata;
-			newdata->edge = first;
+		first = edges[next_edge(hesym)].sym;
+		second = edges[prev_edge(hesym)].sym;
+		if (first >= 0) {
+			edges[first].sym = second;
+			edges[first].edge = newedge;
+			edge_halves[newedge] = first;
 		}
-		if (second) {
-			second->sym = first;
-			second->data = newdata;
-			newdata->edge = second;
+		if (second >= 0) {
+			edges[second].sym = first;
+			edges[second].edge = newedge;
+			edge_halves[newedge] = second;
 		}
 	}
 }
 
+/* Re-anchors the merged vertex [v] and the far corners of the faces of
+ * [he] and [hesym] once those faces are gone */
 void
-Mesh::update_src_neighbors(half_edge* he, vector<half_edge*>& src_neighbors, edge_collapse& ec) {
-    for (unsigned int i = 0; i < src_neighbors.size(); i++) {
-          if (he->sym) {
-              if (src_neighbors[i] == he->sym ||
-                  src_neighbors[i] == he->sym->prev ||
-                  src_neighbors[i] == he->sym->next)
+Mesh::anchor_collapse(int v, int he, int hesym) {
+	int faces[2] = {he, hesym};
+	for (int k=0; k<2; k+=1) {
+		if (faces[k] < 0) continue;
+		int first = edges[next_edge(faces[k])].sym;  // leaves the far corner
+		int second = edges[prev_edge(faces[k])].sym; // leaves the merged vertex
+		int corner = edges[prev_edge(faces[k])].v;
+		if (first >= 0) {
+			anchor_vertex(corner, first);
+			anchor_vertex(v, second >= 0 ? second : next_edge(first));
+		} else if (second >= 0) {
+			anchor_vertex(corner, next_edge(second));
+			anchor_vertex(v, second);
+		}
+	}
+}
+
+void
+Mesh::update_src_neighbors(int he, collapse_scratch& s, edge_collapse& ec) {
+	int hesym = edges[he].sym;
+    for (unsigned int i = 0; i < s.src_neighbors.size(); i++) {
+          int n = s.src_neighbors[i];
+          if (hesym >= 0) {
+              if (n == hesym ||
+                  n == prev_edge(hesym) ||
+                  n == next_edge(hesym))
                 continue;
           }
-          if (src_neighbors[i] == he ||
-              src_neighbors[i] == he->next ||
-              src_neighbors[i] == he->prev)
+          if (n == he ||
+              n == next_edge(he) ||
+              n == prev_edge(he))
             continue;
-          src_neighbors[i]->v = ec.collapseVert; // set vertex to midpoint
-          src_neighbors[i]->data->calculate_quad_error(verts);
-          pq.update(src_neighbors[i]->data->pq_handle);
-          ec.fromV1.push_back(src_neighbors[i]);
+          edges[n].v = ec.collapseVert; // set vertex to midpoint
+          s.touched_edges.push_back(edges[n].edge);
+          ec.fromV1.push_back(n);
     }
 }
 
 void
-Mesh::update_dst_neighbors(half_edge* he, vector<half_edge*>& dst_neighbors, edge_collapse& ec) {
-    for (unsigned int i = 0; i < dst_neighbors.size(); i++) {
-          if (he->sym) {
-              if (dst_neighbors[i] == he->sym ||
-                  dst_neighbors[i] == he->sym->prev ||
-                  dst_neighbors[i] == he->sym->next)
+Mesh::update_dst_neighbors(int he, collapse_scratch& s, edge_collapse& ec) {
+	int hesym = edges[he].sym;
+    for (unsigned int i = 0; i < s.dst_neighbors.size(); i++) {
+          int n = s.dst_neighbors[i];
+          if (hesym >= 0) {
+              if (n == hesym ||
+                  n == prev_edge(hesym) ||
+                  n == next_edge(hesym))
                 continue;
           }
-          if (dst_neighbors[i] == he ||
-              dst_neighbors[i] == he->next ||
-              dst_neighbors[i] == he->prev)
+          if (n == he ||
+              n == next_edge(he) ||
+              n == prev_edge(he))
             continue;
-          dst_neighbors[i]->v = ec.collapseVert; // set vertex to midpoint
-          dst_neighbors[i]->data->calculate_quad_error(verts);
-          pq.update(dst_neighbors[i]->data->pq_handle);
-          ec.fromV2.push_back(dst_neighbors[i]);
+          edges[n].v = ec.collapseVert; // set vertex to midpoint
+          s.touched_edges.push_back(edges[n].edge);
+          ec.fromV2.push_back(n);
     }
 }
 
 void
-Mesh::remove_fins(half_edge* he, edge_collapse& ec) {
+Mesh::remove_fins(int he, edge_collapse& ec) {
 	int counter = 0;
+	int next = next_edge(he);
+	int prev = prev_edge(he);
 	while(true) {
-		if (!he->next->sym || !he->next->sym->prev->sym){
+		int nextsym = edges[next].sym;
+		int prevsym = edges[prev].sym;
+		if (nextsym < 0 || edges[prev_edge(nextsym)].sym < 0){
 			return;
 		}
-		
-		if (he->next->sym->prev->sym->prev != he->prev->sym) {
+
+		if (prev_edge(edges[prev_edge(nextsym)].sym) != prevsym) {
 			return; //no fin
 		}
-		
+
 		//cout << "REMOVING FINS " << counter <<endl;
 		counter += 1;
-		
+
 		/* Removed fins */
-		ec.removed.push_back(he->next->sym);
-		ec.removed.push_back(he->next->sym->next);
-		ec.removed.push_back(he->next->sym->prev);
-		ec.removed.push_back(he->prev->sym);
-		ec.removed.push_back(he->prev->sym->next);
-		ec.removed.push_back(he->prev->sym->prev);
-		edges[he->next->sym->index] = NULL;
-		edges[he->next->sym->next->index] = NULL;
-		edges[he->next->sym->prev->index] = NULL;
-		edges[he->prev->sym->index] = NULL;
-		edges[he->prev->sym->next->index] = NULL;
-		edges[he->prev->sym->prev->index] = NULL;
-		
-		/* remove associated edge_datas */
-		pq.erase(he->next->sym->next->data->pq_handle);
-		delete he->next->sym->next->data;
-		pq.erase(he->prev->sym->prev->data->pq_handle);
-		delete he->prev->sym->prev->data;
-		pq.erase(he->next->sym->prev->data->pq_handle);
-		delete he->next->sym->prev->data;
-		
-		he->next->data->edge = he->next;
-		he->prev->data->edge = he->prev;
-		
+		ec.removed.push_back(nextsym);
+		ec.removed.push_back(next_edge(nextsym));
+		ec.removed.push_back(prev_edge(nextsym));
+		ec.removed.push_back(prevsym);
+		ec.removed.push_back(next_edge(prevsym));
+		ec.removed.push_back(prev_edge(prevsym));
+		removed[nextsym/3] = true;
+		removed[prevsym/3] = true;
+
+		/* retire the associated edge records */
+		retire_edge(edges[next_edge(nextsym)].edge);
+		retire_edge(edges[prev_edge(prevsym)].edge);
+		retire_edge(edges[prev_edge(nextsym)].edge);
+
+		edge_halves[edges[next].edge] = next;
+		edge_halves[edges[prev].edge] = prev;
+
 		/* Only first loop */
 		if (counter == 1) {
-			ec.newVerts.push_back(he->prev->v);
-			ec.changedVerts.push_back(he->prev);
+			ec.newVerts.push_back(edges[prev].v);
+			ec.changedVerts.push_back(prev);
 		}
-		he->prev->v = he->prev->sym->prev->v;
-		
+		edges[prev].v = edges[prev_edge(prevsym)].v;
+
 		/* updata new edge data */
-		half_edge* first = he->next->sym->next;
-		half_edge* second = he->prev->sym->prev;
-		
-		he->next->sym = first->sym;
-		if (first->sym){
-			first->sym->sym = he->next;
-			first->sym->data = he->next->data;
+		int first = edges[next_edge(nextsym)].sym;
+		int second = edges[prev_edge(prevsym)].sym;
+
+		edges[next].sym = first;
+		if (first >= 0){
+			edges[first].sym = next;
+			edges[first].edge = edges[next].edge;
 		}
-		
-		he->prev->sym = second->sym;
-		if (second->sym){
-			second->sym->sym = he->prev;
-			second->sym->data = he->prev->data;
+
+		edges[prev].sym = second;
+		if (second >= 0){
+			edges[second].sym = prev;
+			edges[second].edge = edges[prev].edge;
 		}
+
+		/* the fin's tip is gone and the face now ends at its far side */
+		anchor_vertex(edges[he].v, he);
+		anchor_vertex(edges[next].v, next);
+		anchor_vertex(edges[prev].v, prev);
 	}
 }
 
@@ -522,106 +729,388 @@ Mesh::remove_fins(half_edge* he, edge_collapse& ec) {
  */
 
 void
-Mesh::remove_degenerate(half_edge* he, edge_collapse& ec){
-	half_edge* left = he->prev->sym;
-	half_edge* right = he->next->sym;
-	
-	left->sym = right;
-	right->sym = left;
-	pq.erase(left->data->pq_handle);
-	right->data->edge = right;
-	left->data = right->data;
-
-	edges[he->index]=NULL;
-	edges[he->next->index]=NULL;
-	edges[he->prev->index]=NULL;
+Mesh::remove_degenerate(int he, edge_collapse& ec){
+	int left = edges[prev_edge(he)].sym;
+	int right = edges[next_edge(he)].sym;
+
+	edges[left].sym = right;
+	edges[right].sym = left;
+	retire_edge(edges[left].edge);
+	edge_halves[edges[right].edge] = right;
+	edges[left].edge = edges[right].edge;
+	anchor_vertex(edges[left].v, left);
+	anchor_vertex(edges[right].v, right);
+
+	removed[he/3] = true;
 	ec.removed.push_back(he);
-	ec.removed.push_back(he->next);
-	ec.removed.push_back(he->prev);
-	
-	if (!he->sym) return;
-	
-	he = he->sym;
-	
-	left = he->prev->sym;
-	right = he->next->sym;
-	
-	left->sym = right;
-	right->sym = left;
-	pq.erase(left->data->pq_handle);
-	right->data->edge = right;
-	left->data = right->data;
-
-	edges[he->index]=NULL;
-	edges[he->next->index]=NULL;
-	edges[he->prev->index]=NULL;
+	ec.removed.push_back(next_edge(he));
+	ec.removed.push_back(prev_edge(he));
+
+	if (edges[he].sym < 0) return;
+
+	he = edges[he].sym;
+
+	left = edges[prev_edge(he)].sym;
+	right = edges[next_edge(he)].sym;
+
+	edges[left].sym = right;
+	edges[right].sym = left;
+	retire_edge(edges[left].edge);
+	edge_halves[edges[right].edge] = right;
+	edges[left].edge = edges[right].edge;
+	anchor_vertex(edges[left].v, left);
+	anchor_vertex(edges[right].v, right);
+
+	removed[he/3] = true;
 	ec.removed.push_back(he);
-	ec.removed.push_back(he->next);
-	ec.removed.push_back(he->prev);
+	ec.removed.push_back(next_edge(he));
+	ec.removed.push_back(prev_edge(he));
 }
 
 
+/* True when the ends of [he] share no neighbour but the corners
+ * opposite it; otherwise collapsing it would pinch the surface, tying
+ * two fans into one and leaving degenerate faces behind */
+bool
+Mesh::link_condition(int he, int hesym, collapse_scratch& s) {
+	int v1 = edges[he].v;
+	int v3 = edges[prev_edge(he)].v;
+	int v4 = hesym >= 0 ? edges[prev_edge(hesym)].v : v3;
+	s.link.clear();
+	for (int i=0; i<s.src_neighbors.size(); i+=1) {
+		int h = s.src_neighbors[i];
+		s.link.push_back(edges[next_edge(h)].v);
+		s.link.push_back(edges[prev_edge(h)].v);
+	}
+	sort(s.link.begin(), s.link.end());
+	for (int i=0; i<s.dst_neighbors.size(); i+=1) {
+		int h = s.dst_neighbors[i];
+		int ends[2] = { edges[next_edge(h)].v, edges[prev_edge(h)].v };
+		for (int k=0; k<2; k+=1) {
+			int w = ends[k];
+			if (w != v1 && w != v3 && w != v4 && binary_search(s.link.begin(), s.link.end(), w)) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+/* Collapses the cheapest edge that changes the mesh, unless the
+ * cheapest left costs more than [max_cost] */
 void
-Mesh::collapse_edge() {
-	edge_data *edata;
-	edata = pq.top();
-	if (edata->merge_cost > THRESHOLD || pq.size()<5){
-		return;
+Mesh::collapse_edge(float max_cost) {
+	while (!collapse_top(max_cost)) {}
+}
+
+/* Collapses the cheapest edge. False when the edge was dropped without
+ * changing the mesh, so the next one should be tried; true also when it
+ * costs more than [max_cost] and was left alone. */
+bool
+Mesh::collapse_top(float max_cost) {
+	int e = top_edge();
+	if (e < 0 || merge_costs[e] > min(max_cost, THRESHOLD) || pq.size()<5){
+		return true;
 	}
-	pq.pop();
-	
-	level_of_detail += 1;
-	half_edge* he = edata->edge;
-	half_edge* hesym = he->sym;	
+	return collapse(e);
+}
+
+/* Collapses edge [e], which must be live, into its merge point. False
+ * when the edge was dropped without changing the mesh. */
+bool
+Mesh::collapse(int e) {
+	retire_edge(e);
 	edge_collapse ec; //store edge collapse information
-	ec.V1 = he->v;
-    ec.V2 = he->next->v;
-	int v3 = he->next->next->v;
-	
+	bool changed = collapse_into(e, -1, ec, scratch);
+	update_edges(scratch);
+	finish_collapse(e, changed, ec);
+	return changed;
+}
+
+/* The part of collapse that changes the mesh: edge [e], already out of
+ * the queue, is collapsed, a new vertex going to [slot] when one was
+ * set aside, and the edges whose cost it changed are left in
+ * [s.touched_edges]. Only the fans of the two ends and the faces next
+ * to them are written, so collapses far enough apart can run side by
+ * side. False when the edge was dropped without changing the mesh. */
+bool
+Mesh::collapse_into(int e, int slot, edge_collapse& ec, collapse_scratch& s) {
+	int he = edge_halves[e];
+	int hesym = edges[he].sym;
+	ec.V1 = edges[he].v;
+    ec.V2 = edges[next_edge(he)].v;
+	int v3 = edges[prev_edge(he)].v;
+	s.touched_edges.clear();
+
 	/* Remove degenerates */
 	if (ec.V1 == ec.V2) {
 		//cout << "SAME VERT0" << endl;
 		remove_degenerate(he,ec);
-		collapse_list.push_back(ec);
-		return;
+		return true;
 	}
 	if (ec.V2 == v3) {
 		//cout << "SAME VERT1" << endl;
-		he->data->pq_handle = pq.push(he->data);
-		remove_degenerate(he->next,ec);
-		pq.erase(he->next->data->pq_handle);
-		collapse_list.push_back(ec);
-		return;
+		requeue_edge(e);
+		remove_degenerate(next_edge(he),ec);
+		retire_edge(edges[next_edge(he)].edge);
+		return true;
 	}
 	if (v3 == ec.V1) {
 		//cout << "SAME VERT2" << endl;
-		he->data->pq_handle = pq.push(he->data);
-		remove_degenerate(he->prev,ec);
-		pq.erase(he->prev->data->pq_handle);
-		collapse_list.push_back(ec);
-		return;
+		requeue_edge(e);
+		remove_degenerate(prev_edge(he),ec);
+		retire_edge(edges[prev_edge(he)].edge);
+		return true;
 	}
-	
+
 	remove_fins(he,ec);
-	if (hesym){ 
+	if (hesym >= 0){
 		remove_fins(hesym,ec);
 	}
 
-    vector<half_edge*> src_neighbors;
-    get_src_edges(src_neighbors, he);
-    vector<half_edge*> dst_neighbors;
-    get_dst_edges(dst_neighbors, he);
+    s.src_neighbors.clear();
+    get_src_edges(s.src_neighbors, he);
+    s.dst_neighbors.clear();
+    get_dst_edges(s.dst_neighbors, he);
+	if (!link_condition(he, hesym, s)) {
+		/* out of the queue until a collapse next to it changes its link;
+		 * fins already removed still count */
+		blocked[e] = true;
+		return !ec.removed.empty();
+	}
 
 	/* Calculate new vertex position **/
-	calculate_new_vertex(ec, edata, he, hesym);
+	calculate_new_vertex(ec, e, he, hesym, slot);
     update_edge_pointers(he, hesym);
-    update_src_neighbors(he, src_neighbors, ec);
-    update_dst_neighbors(he, dst_neighbors, ec);
-	
+    anchor_collapse(ec.collapseVert, he, hesym);
+    update_src_neighbors(he, s, ec);
+    update_dst_neighbors(he, s, ec);
+	return true;
+}
+
+/* Counts the collapse of [e] and, when it [changed] the mesh, adds it to
+ * the levels of detail */
+void
+Mesh::finish_collapse(int e, bool changed, edge_collapse& ec) {
+	if (blocked[e]) stats.rejected += 1;
+	if (!changed) return;
+	stats.collapses += 1;
+	level_of_detail += 1;
+	push_collapse(ec);
+}
+
+void
+Mesh::push_collapse(edge_collapse& ec) {
 	collapse_list.push_back(ec);
-	
-	/** Delete removed items **/
-	delete edata;
+	live_faces -= ec.removed.size()/3;
+}
+
+int
+Mesh::face_count() const {
+	return live_faces;
+}
+
+/* Collapses edges until at most [target_faces] faces are left, the next
+ * collapse would cost more than [max_cost], or no edge can be collapsed */
+void
+Mesh::simplify(int target_faces, float max_cost) {
+	while (live_faces > target_faces) {
+		int before = live_faces;
+		collapse_edge(max_cost);
+		if (live_faces == before) break;
+	}
+}
+
+/* Multiple-choice decimation: collapses the cheapest of [k] live edges
+ * drawn at random, with no queue, until at most [target_faces] faces are
+ * left or the live edges run out. A drawn edge costing more than
+ * [max_cost] is retired, since costs only grow as quadrics are added.
+ * The same seed gives the same result. The live edges move from the
+ * queue to an unordered pool on the first call, so simplify() no longer
+ * applies to the mesh afterwards. */
+void
+Mesh::simplify_sampled(int target_faces, int k, unsigned long long seed, float max_cost) {
+	if (!sampled) {
+		sampled = true;
+		for (int e=0; e<merge_costs.size(); e+=1) {
+			if (!retired[e]) pool.insert(e);
+		}
+		pq.clear();
+	}
+	max_cost = min(max_cost, THRESHOLD);
+	edge_compare cheaper(&merge_costs);
+	unsigned long long state = seed*0x9E3779B97F4A7C15ULL | 1; // xorshift, never 0
+	while (live_faces > target_faces && pool.size() >= 5) {
+		int best = -1;
+		for (int i=0; i<k; i+=1) {
+			state ^= state << 13;
+			state ^= state >> 7;
+			state ^= state << 17;
+			int e = pool[state % pool.size()];
+			if (stale[e]) {
+				calculate_quad_error(e);
+				stale[e] = false;
+				stats.evaluations += 1;
+			}
+			if (best < 0 || cheaper(best, e)) best = e;
+		}
+		if (merge_costs[best] > max_cost) {
+			retire_edge(best);
+		} else {
+			collapse(best);
+		}
+	}
+}
+
+/* True when no vertex of the one-ring of [e]'s ends is in the one-ring
+ * of an edge already taken this round; those vertices are then marked.
+ * A collapse writes only the faces around its ends and the flags of the
+ * vertices next to them, and reads at most the faces around those
+ * vertices, so taken edges never touch what another one writes. */
+bool
+Mesh::claim_round(int e) {
+	int he = edge_halves[e];
+	collapse_scratch& s = scratch;
+	s.src_neighbors.clear();
+	get_neighboring_edges(s.src_neighbors, he);
+	for (int i=0; i<s.src_neighbors.size(); i+=1) {
+		int h = s.src_neighbors[i];
+		if (round_marks[edges[next_edge(h)].v] == round_stamp
+			|| round_marks[edges[prev_edge(h)].v] == round_stamp) {
+			return false;
+		}
+	}
+	for (int i=0; i<s.src_neighbors.size(); i+=1) {
+		int h = s.src_neighbors[i];
+		round_marks[edges[next_edge(h)].v] = round_stamp;
+		round_marks[edges[prev_edge(h)].v] = round_stamp;
+	}
+	return true;
+}
+
+/* Collapses the edges of [round_edges] on [threads] threads, ROUND_CHUNK
+ * to a task, each evaluating the edges around its own collapses. The
+ * queue operations they made are then replayed in order, which leaves
+ * the queue as one thread would have, and the new costs applied. */
+void
+Mesh::run_round(int threads) {
+	int n = round_edges.size();
+	int chunks = (n+ROUND_CHUNK-1)/ROUND_CHUNK;
+	if (round_scratch.size() < chunks) {
+		round_scratch.resize(chunks);
+	}
+	round_collapses.assign(n, edge_collapse());
+	round_changed.assign(n, false);
+	in_round = true;
+	parallel_for(threads, chunks, [&](int c) {
+		collapse_scratch& s = round_scratch[c];
+		for (int i=c*ROUND_CHUNK; i<min(n, (c+1)*ROUND_CHUNK); i+=1) {
+			round_changed[i] = collapse_into(round_edges[i], round_slots[i], round_collapses[i], s);
+			evaluate_touched(s);
+		}
+	});
+	in_round = false;
+	for (int i=0; i<round_ops.size(); i+=1) {
+		int e = round_ops[i];
+		if (e >= 0) {
+			pq.erase(pq_handles[e]);
+		} else {
+			pq_handles[~e] = pq.push(~e);
+		}
+		stats.heap_ops += 1;
+	}
+	round_ops.clear();
+	for (int c=0; c<chunks; c+=1) {
+		apply_touched(round_scratch[c]);
+	}
+	for (int i=0; i<n; i+=1) {
+		finish_collapse(round_edges[i], round_changed[i], round_collapses[i]);
+	}
+}
+
+/* simplify in rounds run on [threads] threads. Each round takes edges
+ * from the top of the queue up to a cost cutoff, the cost of the last
+ * of the cheapest 1/ROUND_SHARE of the queue (or of as many as the
+ * target leaves room for), and collapses those that lie apart together;
+ * the rest go back in the queue for the next round. Collapses within a
+ * round are in no particular order, so the result differs a little
+ * from simplify's, but not with the thread count. */
+void
+Mesh::simplify_parallel(int target_faces, int threads, float max_cost) {
+	max_cost = min(max_cost, THRESHOLD);
+	vector<int> deferred;
+	while (live_faces > target_faces) {
+		int window = min(max((int)pq.size()/ROUND_SHARE, 1), max((live_faces-target_faces)/2, 1));
+		if (round_marks.size() < verts.size()) {
+			round_marks.resize(verts.size(), 0);
+		}
+		round_stamp += 1;
+		round_edges.clear();
+		deferred.clear();
+		int e;
+		while (round_edges.size()+deferred.size() < window && pq.size() >= 5
+			   && (e = top_edge()) >= 0 && merge_costs[e] <= max_cost) {
+			retire_edge(e);
+			if (claim_round(e)) {
+				round_edges.push_back(e);
+			} else {
+				deferred.push_back(e);
+			}
+		}
+		for (int i=0; i<deferred.size(); i+=1) {
+			requeue_edge(deferred[i]);
+		}
+		if (round_edges.empty()) break;
+
+		/* new vertices get their slots now, in the order of the round */
+		int slots = verts.size();
+		round_slots.resize(round_edges.size());
+		for (int i=0; i<round_edges.size(); i+=1) {
+			round_slots[i] = needs_vertex(round_edges[i]) ? slots++ : -1;
+		}
+		verts.resize(slots);
+		anchor.resize(slots, -1);
+		boundary.resize(slots, false);
+		if (!double_quadrics.empty()) {
+			double_quadrics.resize(slots);
+		}
+		run_round(threads);
+	}
+}
+
+/* Writes the faces at the current level of detail as OFF, dropping
+ * degenerate faces and unused vertices. Positions are written as
+ * p*scale + offset. */
+bool
+Mesh::write_off(const char* filename, vec3 offset, float scale) {
+	vector<int> ids(verts.size(), -1);
+	vector<int> used, tris;
+	for (int i=0; i<edges.size(); i+=3) {
+		if (removed[i/3]) continue;
+		int tri[3] = {edges[i].v, edges[i+1].v, edges[i+2].v};
+		if (tri[0] == tri[1] || tri[1] == tri[2] || tri[2] == tri[0]) continue;
+		for (int k=0; k<3; k+=1) {
+			if (ids[tri[k]] < 0) {
+				ids[tri[k]] = used.size();
+				used.push_back(tri[k]);
+			}
+			tris.push_back(ids[tri[k]]);
+		}
+	}
+	FILE* out = fopen(filename, "w");
+	if (!out) {
+		cout << "Unable to open file " << filename << endl;
+		return false;
+	}
+	fprintf(out, "OFF\n%d %d 0\n", (int)used.size(), (int)tris.size()/3);
+	for (int i=0; i<used.size(); i+=1) {
+		vec3 p = verts[used[i]].position*scale + offset;
+		fprintf(out, "%.9g %.9g %.9g\n", p.x, p.y, p.z);
+	}
+	for (int i=0; i<tris.size(); i+=3) {
+		fprintf(out, "3 %d %d %d\n", tris[i], tris[i+1], tris[i+2]);
+	}
+	return fclose(out) == 0;
 }
 
 void
@@ -633,22 +1122,23 @@ Mesh::upLevelOfDetail(const int num) {
 		
 		level_of_detail -= 1;
 		edge_collapse ec = collapse_list[level_of_detail];
+		live_faces += ec.removed.size()/3;
 		
 		for (int i=0; i<ec.removed.size(); i+=1) {
-			edges[ec.removed[i]->index] = ec.removed[i];
+			removed[ec.removed[i]/3] = false;
 		}
 		
 		for (int i=0; i<ec.fromV1.size(); i+=1) {
-			ec.fromV1[i]->v = ec.V1;
+			edges[ec.fromV1[i]].v = ec.V1;
 		}
 		
 		for (int i=0; i<ec.fromV2.size(); i+=1) {
-			ec.fromV2[i]->v = ec.V2;
+			edges[ec.fromV2[i]].v = ec.V2;
 		}
 		
 		for (int i=0; i<ec.newVerts.size(); i+=1) {
-			int vert = ec.changedVerts[i]->v;
-			ec.changedVerts[i]->v = ec.newVerts[i];
+			int vert = edges[ec.changedVerts[i]].v;
+			edges[ec.changedVerts[i]].v = ec.newVerts[i];
 			ec.newVerts[i] = vert;
 		}
 	}
@@ -663,22 +1153,23 @@ Mesh::downLevelOfDetail(const int num) {
 			continue;
 		}
 		edge_collapse ec = collapse_list[level_of_detail];
+		live_faces -= ec.removed.size()/3;
 		
 		for (int i=0; i<ec.removed.size(); i+=1) {
-			edges[ec.removed[i]->index] = NULL;
+			removed[ec.removed[i]/3] = true;
 		}
 		
 		for (int i=0; i<ec.fromV1.size(); i+=1) {
-			ec.fromV1[i]->v = ec.collapseVert;
+			edges[ec.fromV1[i]].v = ec.collapseVert;
 		}
 		
 		for (int i=0; i<ec.fromV2.size(); i+=1) {
-			ec.fromV2[i]->v = ec.collapseVert;
+			edges[ec.fromV2[i]].v = ec.collapseVert;
 		}
 		
 		for (int i=0; i<ec.newVerts.size(); i+=1) {
-			int vert = ec.changedVerts[i]->v;
-			ec.changedVerts[i]->v = ec.newVerts[i];
+			int vert = edges[ec.changedVerts[i]].v;
+			edges[ec.changedVerts[i]].v = ec.newVerts[i];
 			ec.newVerts[i] = vert;
 		}
 		
@@ -687,36 +1178,3 @@ Mesh::downLevelOfDetail(const int num) {
 }
 
 
-void
-Mesh::update_buffer() {
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, NULL);
-	
-	vector<GLuint> elements;
-	vector<half_edge*>::iterator it;
-	for (it=edges.begin(); it!=edges.end(); ++it) {
-		if (*it) {
-			elements.push_back((*it)->v);
-		}
-	}
-	
-	cout << "Triangles: " << elements.size()/3 << endl;
-	numIndices = elements.size();
-	
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementArrayBuffer);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint)*elements.size(), &elements[0], GL_STATIC_DRAW);
-	if (max_lod < level_of_detail){
-		max_lod = level_of_detail;
-		vector<vertex_data> vertdata;
-		for (int i=0; i<verts.size(); i+=1){
-			vertdata.push_back(verts[i].data());
-		}
-		glBindBuffer(GL_ARRAY_BUFFER, NULL);
-		glBindBuffer(GL_ARRAY_BUFFER, arrayBuffer);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(vertex_data)*vertdata.size(), &vertdata[0], GL_STATIC_DRAW);
-	}
-}
-
-void
-Mesh::draw() {
-	glDrawElements(GL_TRIANGLES, numIndices, GL_UNSIGNED_INT, BUFFER_OFFSET(0));
-}
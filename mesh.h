@@ -1,18 +1,18 @@
 #ifndef MESH_H
 #define MESH_H
 
-#include <GLUT/glut.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <vector>
+#include <cfloat>
 #include <iostream>
 #include <utility>
 #include <list>
-#include <boost/unordered_map.hpp>
+#include <mutex>
 #include <boost/heap/binomial_heap.hpp>
-
-#define BUFFER_OFFSET(i) (reinterpret_cast<void*>(i))
+#include "quadric.h"
+#include "edge_heap.h"
 
 typedef glm::mat3 mat3 ;
 typedef glm::mat4 mat4 ; 
@@ -26,13 +26,14 @@ using namespace std;
 struct vertex_data {
 	vec3 position; 
 	vec3 normal;
-	GLfloat padding[2];
+	float padding[2];
 };
 
 struct vertex {
+	quadric Q;  // first, so its alignment costs no padding
 	vec3 position; 
 	vec3 normal;
-	GLfloat Q[10];
+	bool locked; // never moved or merged by a collapse
 	vertex(float,float,float);
 	vertex(vertex*);
 	vertex();
@@ -41,36 +42,106 @@ struct vertex {
 
 typedef boost::shared_ptr<vertex> vertexPtr;
 
-struct half_edge;
-struct edge_data;
+/* Arithmetic of the edge costs. Float keeps the vertex quadrics as
+ * loaded and works in float; mixed widens them to double for each sum,
+ * solve and evaluation; double also accumulates a double quadric per
+ * vertex, from the faces and through every collapse. Queue keys are
+ * float in all three. */
+enum quadric_precision { FLOAT_QUADRICS, MIXED_QUADRICS, DOUBLE_QUADRICS };
+
+/* Orders edge ids by their merge cost, cheapest on top, and equal costs
+ * by id, so every queue pops the same sequence */
 struct edge_compare {
-	bool operator() (const edge_data* he1, const edge_data* he2) const;
+	const vector<float>* costs;
+	edge_compare(const vector<float>* c = NULL) : costs(c) {}
+	bool operator() (int e1, int e2) const {
+		float c1 = (*costs)[e1], c2 = (*costs)[e2];
+		return c1 > c2 || (c1 == c2 && e1 > e2);
+	}
 };
-struct edge_compare;
 
-typedef boost::heap::binomial_heap<edge_data*, boost::heap::compare<edge_compare> > priorityQueue;
+/* -DBINOMIAL_QUEUE builds with the node-based boost heap, for comparison;
+ * -DBUCKET_QUEUE with the bucket queue, which only orders the cheapest
+ * bucket of costs */
+#ifdef BINOMIAL_QUEUE
+typedef boost::heap::binomial_heap<int, boost::heap::compare<edge_compare> > priorityQueue;
+#elif defined(BUCKET_QUEUE)
+typedef edge_buckets<edge_compare> priorityQueue;
+#else
+typedef edge_heap<edge_compare> priorityQueue;
+#endif
 typedef priorityQueue::handle_type edge_handle;
 
-struct edge_data {
-	vec3 merge_point;
-	float merge_cost;
-	half_edge *edge; //the half edges this data represents
-	edge_handle pq_handle;
-	void calculate_quad_error(vector<vertex>&);
+/* Work done by the collapses since the mesh was built: cost
+ * evaluations and queue operations (push, pop, update, erase) */
+struct queue_stats {
+	long collapses;
+	long evaluations;
+	long heap_ops;
+	long rejected; // popped edges whose collapse would pinch the surface
+	queue_stats() : collapses(0), evaluations(0), heap_ops(0), rejected(0) {}
 };
 
+/* Half-edges are stored three per face in one array: half-edge h
+ * belongs to face h/3 and runs from its vertex to the vertex of
+ * next_edge(h). Faces keep their three half-edges for life, so next
+ * and prev follow from the position and only the twin is stored. */
 struct half_edge {
 	int v;
-	half_edge *prev, *next, *sym; //anti-clockwise ordering
-	edge_data* data;
-	int index;
+	int sym;  // twin half-edge, or -1 on a boundary
+	int edge; // undirected edge id, shared with the twin
+};
+
+inline int next_edge(int h) { return h%3 == 2 ? h-2 : h+1; } //anti-clockwise ordering
+inline int prev_edge(int h) { return h%3 == 0 ? h+2 : h-1; }
+
+/* Steps through the half-edges leaving a vertex, one fan in a single
+ * sweep: from [h], to the twin of the previous half-edge, until the fan
+ * closes or runs into a boundary. A fan that a bad collapse has tied
+ * into a loop not through [h] ends after every half-edge was visited. */
+class ring_circulator {
+	const vector<half_edge>* edges;
+	int first;
+	int cur;
+	size_t steps;
+  public:
+	ring_circulator(const vector<half_edge>& e, int h) : edges(&e), first(h), cur(h), steps(0) {}
+	int operator*() const { return cur; }
+	bool done() const { return cur < 0; }
+	ring_circulator& operator++() {
+		cur = (*edges)[prev_edge(cur)].sym;
+		if (cur == first || ++steps >= edges->size()) cur = -1;
+		return *this;
+	}
 };
 
+/* The ends of an edge and what limits where they may merge */
+struct edge_target {
+	int v1, v2;
+	vec3 fixed;       // merge point when not free, fallback when singular
+	float multiplier; // cost scale for edges touching the boundary
+	bool free;        // may move to the point of least error
+	bool penalty;     // both ends on the boundary: collapse near the end
+	bool locked;      // an end is locked
+};
+
+/* Scratch space of one collapse, kept to reuse its capacity; each task
+ * of a parallel round has its own */
+struct collapse_scratch {
+	vector<int> src_neighbors;
+	vector<int> dst_neighbors;
+	vector<int> link;          // neighbours of one end, for link_condition
+	vector<int> touched_edges; // edges of both fans, re-evaluated together
+	vector<int> eager_edges;   // those of them a lazy update evaluates now
+	vector<float> fresh_costs; // their new costs, applied to the queue one by one
+};
+
+/* Half-edges are recorded by index */
 struct edge_collapse {
-	vector<half_edge*> removed;
-	vector<half_edge*> fromV1;
-	vector<half_edge*> fromV2;
-	vector<half_edge*> changedVerts;
+	vector<int> removed;
+	vector<int> fromV1;
+	vector<int> fromV2;
+	vector<int> changedVerts;
 	vector<int> newVerts;
 	int V1;
 	int V2;
@@ -81,36 +152,121 @@ struct edge_collapse {
 /********* Comprehensive Mesh definition **********/
 
 class Mesh {
-  GLuint arrayBuffer;
-  GLuint elementArrayBuffer;
+  unsigned int arrayBuffer;       // GL buffer names, see render.cpp
+  unsigned int elementArrayBuffer;
   unsigned int numIndices;
   vector<edge_collapse> collapse_list;
   int level_of_detail;
   int max_lod;
+  int live_faces;
+  collapse_scratch scratch;
+  /* State of simplify_parallel: the edges of a round, the vertex slot
+   * each merges into, their records and one scratch per task; a stamp
+   * per vertex near an edge already taken; and the queue operations
+   * made while the round runs, replayed once it is over (~e for a
+   * push) */
+  vector<int> round_edges;
+  vector<int> round_slots;
+  vector<edge_collapse> round_collapses;
+  vector<char> round_changed;
+  vector<collapse_scratch> round_scratch;
+  vector<int> round_marks;
+  int round_stamp;
+  bool in_round;
+  mutex round_lock;
+  vector<int> round_ops;
+  /* Set by simplify_sampled: the live edges are kept in [pool], in no
+   * order, instead of the queue */
+  bool sampled;
+  edge_set pool;
+  Mesh();
+  void push_collapse(edge_collapse&);
+  void accumulate_double_quadrics();
+  template <class S> basic_quadric<S> edge_quadric(int v1, int v2) const;
+  template <class S> void evaluate_edge(int id);
+  template <class S> void evaluate_edges(const int* ids, int n);
+  bool needs_vertex(int e) const;
+  bool claim_round(int e);
+  void run_round(int threads);
   public:
-	vector<half_edge*> edges;
+	vector<half_edge> edges;
+	/* Flags are kept a byte each, so collapses running side by side can
+	 * set their own */
+	vector<char> removed; // per face, set while a collapse has taken it out
 	vector<vertex> verts;
-	boost::unordered_map< pair<int, int>, half_edge* > existing_edges;
+	/* A half-edge leaving each vertex, the first of its fan: a boundary
+	 * half-edge whenever the vertex is on a boundary. Kept up to date by
+	 * collapse_edge; stepping the level of detail leaves it alone, since
+	 * edges are only collapsed at the coarsest level. */
+	vector<int> anchor;
+	vector<char> boundary; // per vertex, set when its anchor has no twin
+	quadric_precision precision;
+	vector<quadric_d> double_quadrics; // per vertex, with DOUBLE_QUADRICS only
+
+	/* Undirected edge records, one slot per edge id. An edge is retired
+	 * once it has been collapsed or merged into a neighbour; its slot
+	 * stays but it is never queued again. */
+	vector<vec3> merge_points;
+	vector<float> merge_costs;
+	vector<int> edge_halves; // a live half-edge of each edge
+	vector<edge_handle> pq_handles;
+	vector<char> retired;
+	/* With [lazy] set, a collapse does not re-evaluate the interior edges
+	 * around it: each is marked stale and keeps its old cost as its key.
+	 * Adding a quadric never lowers its minimum, so that key is a lower
+	 * bound, up to the tie-break offset; top_edge evaluates a stale edge
+	 * once it surfaces. */
+	bool lazy;
+	vector<char> stale;
+	vector<char> blocked; // retired until a neighbouring collapse, see link_condition
+	queue_stats stats;
 	priorityQueue pq;
-	Mesh(vector<vertex>& vertices, vector<vec3>& faces);
+	Mesh(vector<vertex>& vertices, vector<vec3>& faces, int threads = 1,
+	     quadric_precision precision = FLOAT_QUADRICS);
 	~Mesh();
-	void populate_symmetric_edge(half_edge*, int, int,vector<edge_data*>&);
-	pair<int, int> get_vertex_key(int,int);
-	void get_src_edges(vector<half_edge*>&, half_edge*);
-	void get_dst_edges(vector<half_edge*>&, half_edge*);
-	void get_neighboring_edges(vector<half_edge*>&, half_edge*);
-	void collapse_edge();
-	void remove_fins(half_edge* he, edge_collapse& ec);
-    void calculate_new_vertex(edge_collapse&, edge_data*, half_edge*, half_edge*);
-    void update_edge_pointers(half_edge* he, half_edge* hesym);
-    void update_src_neighbors(half_edge* he, vector<half_edge*>& neighbors, edge_collapse& ec);
-    void update_dst_neighbors(half_edge* he, vector<half_edge*>& neighbors, edge_collapse& ec);
-	void remove_degenerate(half_edge* he, edge_collapse&);
+	void get_src_edges(vector<int>&, int);
+	void get_dst_edges(vector<int>&, int);
+	void get_neighboring_edges(vector<int>&, int);
+	void get_ring(vector<int>&, int v, int h);
+	int fan_start(int h) const;
+	void anchor_vertex(int v, int h);
+	void anchor_collapse(int v, int he, int hesym);
+	int top_edge();
+	bool link_condition(int he, int hesym, collapse_scratch& s);
+	bool collapse_top(float max_cost = FLT_MAX);
+	bool collapse(int e);
+	bool collapse_into(int e, int slot, edge_collapse& ec, collapse_scratch& s);
+	void finish_collapse(int e, bool changed, edge_collapse& ec);
+	void collapse_edge(float max_cost = FLT_MAX);
+	void simplify(int target_faces, float max_cost = FLT_MAX);
+	void simplify_sampled(int target_faces, int k, unsigned long long seed,
+	                      float max_cost = FLT_MAX);
+	void simplify_parallel(int target_faces, int threads, float max_cost = FLT_MAX);
+	void remove_fins(int he, edge_collapse& ec);
+	void merge_target(int id, edge_target& t) const;
+	void calculate_quad_error(int id);
+	void calculate_quad_errors(const int* ids, int n);
+	void retire_edge(int e);
+	void requeue_edge(int e);
+	void update_edge(int e);
+	void evaluate_touched(collapse_scratch& s);
+	void apply_touched(collapse_scratch& s);
+	void update_edges(collapse_scratch& s);
+    void calculate_new_vertex(edge_collapse&, int e, int he, int hesym, int slot = -1);
+    void update_edge_pointers(int he, int hesym);
+    void update_src_neighbors(int he, collapse_scratch& s, edge_collapse& ec);
+    void update_dst_neighbors(int he, collapse_scratch& s, edge_collapse& ec);
+	void remove_degenerate(int he, edge_collapse&);
+	void init_buffers();
 	void update_buffer();
 	void draw();
 	void upLevelOfDetail(const int);
 	void downLevelOfDetail(const int);
+	int face_count() const;
+	bool write_off(const char* filename, vec3 offset = vec3(0), float scale = 1);
     void debug();
+	bool write_progressive(const char* filename);
+	static Mesh* read_progressive(const char* filename);
 };
 
 #endif //MESH_H
@@ -0,0 +1,101 @@
+#include <algorithm>
+#include <stdint.h>
+#include "pairing.h"
+#include "threadpool.h"
+
+using namespace std;
+
+struct edge_key {
+	uint64_t key;
+	int he;
+};
+
+const int RADIX_BITS = 8;
+const int RADIX = 1 << RADIX_BITS;
+const int SORT_BLOCK = 1 << 16;
+
+/* Stable LSD radix sort of [a] by key, using [tmp] as scratch. Each
+ * block of records gets its own histogram, so the scatter runs in
+ * parallel and still keeps equal keys in their input order. Passes
+ * whose digit is the same for every key are skipped, so small meshes
+ * only pay for the bits their vertex ids use. */
+static void
+radix_sort(vector<edge_key>& a, vector<edge_key>& tmp, int threads) {
+	int n = a.size();
+	int blocks = (n + SORT_BLOCK-1)/SORT_BLOCK;
+	vector<int> count(blocks*RADIX);
+	tmp.resize(n);
+	for (int shift=0; shift<64; shift+=RADIX_BITS) {
+		fill(count.begin(), count.end(), 0);
+		parallel_for(threads, blocks, [&](int b) {
+			int* c = &count[b*RADIX];
+			int end = min(n, (b+1)*SORT_BLOCK);
+			for (int i=b*SORT_BLOCK; i<end; i+=1) {
+				c[(a[i].key >> shift) & (RADIX-1)] += 1;
+			}
+		});
+
+		/* Offsets in digit-major, block-minor order */
+		bool constant = false;
+		int total = 0;
+		for (int d=0; d<RADIX; d+=1) {
+			int digit = 0;
+			for (int b=0; b<blocks; b+=1) {
+				int c = count[b*RADIX+d];
+				count[b*RADIX+d] = total;
+				total += c;
+				digit += c;
+			}
+			constant = constant || digit == n;
+		}
+		if (constant) continue;
+
+		parallel_for(threads, blocks, [&](int b) {
+			int* offset = &count[b*RADIX];
+			int end = min(n, (b+1)*SORT_BLOCK);
+			for (int i=b*SORT_BLOCK; i<end; i+=1) {
+				tmp[offset[(a[i].key >> shift) & (RADIX-1)]++] = a[i];
+			}
+		});
+		a.swap(tmp);
+	}
+}
+
+void
+pairHalfEdges(const vector<vec3>& faces, vector<int>& sym, vector<int>& owner, int threads) {
+	int n = 3*faces.size();
+	int blocks = (n + SORT_BLOCK-1)/SORT_BLOCK;
+	vector<edge_key> keys(n), tmp;
+	parallel_for(threads, blocks, [&](int b) {
+		int end = min(n, (b+1)*SORT_BLOCK);
+		for (int i=b*SORT_BLOCK; i<end; i+=1) {
+			uint32_t v0 = faces[i/3][i%3];
+			uint32_t v1 = faces[i/3][(i+1)%3];
+			keys[i].key = ((uint64_t)min(v0, v1) << 32) | max(v0, v1);
+			keys[i].he = i;
+		}
+	});
+	radix_sort(keys, tmp, threads);
+
+	/* Runs of equal keys are edges; a block handles the runs that start
+	 * inside it */
+	sym.assign(n, -1);
+	owner.resize(n);
+	parallel_for(threads, blocks, [&](int b) {
+		int end = min(n, (b+1)*SORT_BLOCK);
+		int i = b*SORT_BLOCK;
+		while (i < end && i > 0 && keys[i].key == keys[i-1].key) ++i;
+		while (i < end) {
+			int first = keys[i].he;
+			int j = i+1;
+			while (j < n && keys[j].key == keys[i].key) {
+				owner[keys[j].he] = first;
+				sym[keys[j].he] = first;
+				sym[first] = keys[j].he;
+				++j;
+			}
+			owner[first] = first;
+			i = j;
+		}
+	});
+}
@@ -0,0 +1,20 @@
+#ifndef PAIRING_H
+#define PAIRING_H
+
+#include "mesh.h"
+
+/********* Sort based half-edge pairing ***********/
+
+/* Finds the twin of every half-edge of [faces]. Half-edge 3f+k runs from
+ * faces[f][k] to faces[f][(k+1)%3]. Each undirected edge is packed into
+ * a 64 bit key (smaller vertex in the high word), the keys are radix
+ * sorted in parallel, and every run of equal keys is one edge.
+ *
+ * owner[i] is the lowest numbered half-edge of i's edge, which holds the
+ * shared edge data. sym[i] is i's twin, or -1 on a boundary; an edge
+ * with more than two faces is linked the way the old hash map did it:
+ * every later half-edge points at the owner and the owner at the last. */
+void pairHalfEdges(const vector<vec3>& faces, vector<int>& sym, vector<int>& owner,
+					int threads = 1);
+
+#endif //PAIRING_H
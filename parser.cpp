@@ -2,7 +2,9 @@
 #include <sstream>
 #include <fstream>
 #include <string>
+#include <GLUT/glut.h>
 #include "mesh.h"
+#include "loader.h"
 
 using namespace std;
 
@@ -85,105 +87,21 @@ void parseConfig(const char* filename){
 	}
 }
 
-Mesh* parseOFF(char* filename){
-	ifstream myfile(filename, ifstream::in);
-	if(!myfile.is_open()){
-		cout << "Unable to open file " << filename << endl;
-		exit(1);
-	}
-	
-	vector<vertex> vertices; // vectors
-	vector<vec3> faces; // faces
-	int numVerts, numFaces;
-	string line;
-	
-	getline(myfile, line); //skip first line
-	getline(myfile, line);
-	stringstream firstln(line);
-	firstln >> numVerts >> numFaces;
-	
-	vertices.reserve(numVerts);
-	faces.reserve(numFaces);
-	
-	float minx = 999999;
-	float maxx = -999999;
-	float miny = 999999;
-	float maxy = -999999;
-	float minz = 999999;
-	float maxz = -999999;
-	
-	for (int i=0; i<numVerts; i+=1){
-		float x,y,z;
-		getline(myfile, line);
-		stringstream ln(line);
-		ln >> x >> y >> z;
-		minx = min(x,minx);
-		maxx = max(x,maxx);
-		miny = min(y,miny);
-		maxy = max(y,maxy);
-		minz = min(z,minz);
-		maxz = max(z,maxz);
-		vertex v = vertex(x,y,z);
-		vertices.push_back(v);
-	}
-	
-	/*** Center model around origin  ***/
-	
-	float middlex = (maxx+minx)/2.0;
-	float middley = (maxy+miny)/2.0;
-	float middlez = (maxz+minz)/2.0;
-	vec3 makeMiddle(middlex,middley,middlez);
-	float ratio = 8.0/max(max(maxx-minx, maxy-miny), maxz-minz);
-	
-	for (int i=0; i<numFaces; i+=1){
-		int vid0,vid1,vid2,junk;
-		getline(myfile, line);
-		stringstream ln(line);
-		ln >> junk >> vid0 >> vid1 >> vid2;
-		vec3 f(vid0,vid1,vid2);
-		faces.push_back(f);
-		vec3 v0 = vertices[vid0].position;
-		vec3 v1 = vertices[vid1].position;
-		vec3 v2 = vertices[vid2].position;
-		vec3 norm = glm::cross(v1-v0,v2-v0);
-		vertices[vid0].normal += norm;
-		vertices[vid1].normal += norm;
-		vertices[vid2].normal += norm;
+/* Reads and prepares the model, printing the load statistics; returns
+ * false if it could not be read */
+bool parseOFF(const char* filename, int threads, bool use_cache,
+				vector<vertex>& vertices, vector<vec3>& faces) {
+	load_stats stats;
+	if (!loadMesh(filename, vertices, faces, threads, use_cache, &stats)) {
+		return false;
 	}
-	myfile.close();
-	
-	for (int i=0; i<numVerts; i+=1) {
-		vertices[i].normal = glm::normalize(vertices[i].normal);
-		vertices[i].position -= makeMiddle;
-		vertices[i].position *= ratio;
+	cout << (stats.from_cache ? "Loaded cache of " : "Parsed ")
+		 << stats.bytes/(1024.0*1024.0) << " MB in "
+		 << stats.parse_seconds*1000 << " ms (" << stats.megabytes_per_second()
+		 << " MB/s on " << stats.threads << " threads)" << endl;
+	if (stats.compressed_bytes) {
+		cout << "Decompressed " << stats.compressed_bytes/(1024.0*1024.0) << " MB in "
+			 << stats.decompress_seconds*1000 << " ms alongside the parse" << endl;
 	}
-	
-	/** Calculate Quadratic error matrix **/
-	for (int i=0; i<numFaces; i+=1) {
-		vec3 f = faces[i];
-		int vid0 = f[0];
-		int vid1 = f[1];
-		int vid2 = f[2];
-		vec3 v0 = vertices[vid0].position;
-		vec3 v1 = vertices[vid1].position;
-		vec3 v2 = vertices[vid2].position;
-		
-		vec3 norm = glm::cross(v1-v0,v2-v0);
-		norm = glm::normalize(norm);
-		vec4 p = vec4(norm,-glm::dot(norm,v0));
-		
-		int index = 0;
-		for (int y=0; y<4; y+=1){
-			for (int x=y; x < 4; x+=1){
-				float Qvalue = p[x]*p[y];
-				vertices[vid0].Q[index] += Qvalue;
-				vertices[vid1].Q[index] += Qvalue;
-				vertices[vid2].Q[index] += Qvalue;
-				index += 1;
-			}
-		}
-	}
-	
-    return new Mesh(vertices, faces);
+	return true;
 }
-
@@ -0,0 +1,324 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <cstring>
+#include <algorithm>
+#include <climits>
+#include <stdint.h>
+#include "loader.h"
+#include "threadpool.h"
+#include "timer.h"
+
+using namespace std;
+
+/** Binary PLY reader. The header is read as text; the vertex and face
+ * blocks are then copied out of the mapped file without any text
+ * conversion. Polygons are triangulated as fans, like OFF faces. */
+
+enum ply_type { PLY_INT8, PLY_UINT8, PLY_INT16, PLY_UINT16, PLY_INT32, PLY_UINT32,
+				PLY_FLOAT32, PLY_FLOAT64, PLY_INVALID };
+
+static const int PLY_SIZE[] = {1, 1, 2, 2, 4, 4, 4, 8, 0};
+
+struct ply_property {
+	string name;
+	ply_type type;
+	bool list;
+	ply_type count_type;
+};
+
+struct ply_element {
+	string name;
+	long long count;
+	vector<ply_property> props;
+	/* Bytes per record, or -1 if the element has list properties */
+	int stride() const {
+		int s = 0;
+		for (int i=0; i<props.size(); i+=1) {
+			if (props[i].list) return -1;
+			s += PLY_SIZE[props[i].type];
+		}
+		return s;
+	}
+};
+
+static ply_type
+parse_type(const string& t) {
+	if (t == "char" || t == "int8") return PLY_INT8;
+	if (t == "uchar" || t == "uint8") return PLY_UINT8;
+	if (t == "short" || t == "int16") return PLY_INT16;
+	if (t == "ushort" || t == "uint16") return PLY_UINT16;
+	if (t == "int" || t == "int32") return PLY_INT32;
+	if (t == "uint" || t == "uint32") return PLY_UINT32;
+	if (t == "float" || t == "float32") return PLY_FLOAT32;
+	if (t == "double" || t == "float64") return PLY_FLOAT64;
+	return PLY_INVALID;
+}
+
+/* Reads one value of [type] at [p], swapping bytes for big endian files */
+static inline double
+read_value(const char* p, ply_type type, bool swap) {
+	char b[8];
+	int n = PLY_SIZE[type];
+	if (swap) {
+		for (int i=0; i<n; i+=1) b[i] = p[n-1-i];
+	} else {
+		memcpy(b, p, n);
+	}
+	switch (type) {
+		case PLY_INT8: return *(int8_t*)b;
+		case PLY_UINT8: return *(uint8_t*)b;
+		case PLY_INT16: { int16_t v; memcpy(&v, b, 2); return v; }
+		case PLY_UINT16: { uint16_t v; memcpy(&v, b, 2); return v; }
+		case PLY_INT32: { int32_t v; memcpy(&v, b, 4); return v; }
+		case PLY_UINT32: { uint32_t v; memcpy(&v, b, 4); return v; }
+		case PLY_FLOAT32: { float v; memcpy(&v, b, 4); return v; }
+		case PLY_FLOAT64: { double v; memcpy(&v, b, 8); return v; }
+		default: return 0;
+	}
+}
+
+static inline bool
+host_little_endian() {
+	const uint16_t one = 1;
+	return *(const uint8_t*)&one == 1;
+}
+
+/* Parses the text header; [p] is left at the first byte of data */
+static bool
+parse_header(const char*& p, const char* end, vector<ply_element>& elements, bool& swap) {
+	const char* stop = NULL;
+	for (const char* q = p; q+10 <= end; q+=1) {
+		if (!memcmp(q, "end_header", 10)) {
+			stop = q;
+			break;
+		}
+	}
+	if (end-p < 3 || memcmp(p, "ply", 3) != 0 || !stop) return false;
+	string header(p, stop);
+	p = skip_line(stop, end);
+
+	stringstream in(header);
+	string line;
+	bool format = false;
+	while (getline(in, line)) {
+		stringstream ln(line);
+		string cmd;
+		ln >> cmd;
+		if (cmd == "format") {
+			string fmt;
+			ln >> fmt;
+			if (fmt == "binary_little_endian") {
+				swap = !host_little_endian();
+			} else if (fmt == "binary_big_endian") {
+				swap = host_little_endian();
+			} else {
+				return false;
+			}
+			format = true;
+		} else if (cmd == "element") {
+			ply_element e;
+			if (!(ln >> e.name >> e.count) || e.count < 0 || e.count > INT_MAX) return false;
+			elements.push_back(e);
+		} else if (cmd == "property") {
+			if (elements.empty()) return false;
+			ply_property prop;
+			string t;
+			ln >> t;
+			if (t == "list") {
+				string ct, it;
+				ln >> ct >> it;
+				prop.list = true;
+				prop.count_type = parse_type(ct);
+				prop.type = parse_type(it);
+				if (prop.count_type == PLY_INVALID) return false;
+			} else {
+				prop.list = false;
+				prop.count_type = PLY_INVALID;
+				prop.type = parse_type(t);
+			}
+			if (prop.type == PLY_INVALID) return false;
+			ln >> prop.name;
+			elements.back().props.push_back(prop);
+		}
+	}
+	return format;
+}
+
+/* Moves past one record of [e]; returns NULL if it runs off the end */
+static inline const char*
+skip_record(const char* p, const char* end, const ply_element& e, bool swap) {
+	for (int i=0; i<e.props.size(); i+=1) {
+		const ply_property& prop = e.props[i];
+		if (prop.list) {
+			if (end-p < PLY_SIZE[prop.count_type]) return NULL;
+			long long n = (long long)read_value(p, prop.count_type, swap);
+			p += PLY_SIZE[prop.count_type];
+			if (n < 0 || end-p < n*PLY_SIZE[prop.type]) return NULL;
+			p += n*PLY_SIZE[prop.type];
+		} else {
+			if (end-p < PLY_SIZE[prop.type]) return NULL;
+			p += PLY_SIZE[prop.type];
+		}
+	}
+	return p;
+}
+
+static const char*
+read_vertices(const char* p, const char* end, const ply_element& e, bool swap,
+				int threads, vector<vertex>& vertices) {
+	int stride = e.stride();
+	int offset[3] = {-1, -1, -1};
+	ply_type type[3] = {PLY_INVALID, PLY_INVALID, PLY_INVALID};
+	int at = 0;
+	for (int i=0; stride > 0 && i<e.props.size(); i+=1) {
+		const string& n = e.props[i].name;
+		int axis = (n == "x") ? 0 : (n == "y") ? 1 : (n == "z") ? 2 : -1;
+		if (axis >= 0) {
+			offset[axis] = at;
+			type[axis] = e.props[i].type;
+		}
+		at += PLY_SIZE[e.props[i].type];
+	}
+	if (stride <= 0 || offset[0] < 0 || offset[1] < 0 || offset[2] < 0 ||
+		end-p < e.count*stride) {
+		return NULL;
+	}
+
+	int numVerts = e.count;
+	vertices.assign(numVerts, vertex(0,0,0));
+	bool direct = !swap && type[0] == PLY_FLOAT32 && type[1] == PLY_FLOAT32 && type[2] == PLY_FLOAT32;
+	parallel_for(threads, (numVerts+65535)/65536, [&](int b) {
+		int last = min(numVerts, (b+1)*65536);
+		for (int i=b*65536; i<last; i+=1) {
+			const char* rec = p + (size_t)i*stride;
+			vertex& v = vertices[i];
+			if (direct) {
+				memcpy(&v.position[0], rec+offset[0], 4);
+				memcpy(&v.position[1], rec+offset[1], 4);
+				memcpy(&v.position[2], rec+offset[2], 4);
+			} else {
+				for (int k=0; k<3; k+=1) {
+					v.position[k] = read_value(rec+offset[k], type[k], swap);
+				}
+			}
+		}
+	});
+	return p + (size_t)numVerts*stride;
+}
+
+static const char*
+read_faces(const char* p, const char* end, const ply_element& e, bool swap,
+			int numVerts, vector<vec3>& faces) {
+	int list = -1;
+	for (int i=0; i<e.props.size(); i+=1) {
+		if (e.props[i].list && (e.props[i].name == "vertex_indices" || e.props[i].name == "vertex_index")) {
+			list = i;
+		}
+	}
+	if (list < 0) return NULL;
+	const ply_property& idx = e.props[list];
+	faces.clear();
+	faces.reserve(e.count);
+
+	/* The common uchar count + 32 bit index layout gets a tight loop */
+	if (e.props.size() == 1 && !swap && idx.count_type == PLY_UINT8 &&
+		(idx.type == PLY_INT32 || idx.type == PLY_UINT32)) {
+		for (long long f=0; f<e.count; f+=1) {
+			if (p == end) return NULL;
+			int n = (uint8_t)*p++;
+			if (n < 3 || end-p < n*4) return NULL;
+			int32_t ids[256];
+			memcpy(ids, p, n*4);
+			p += n*4;
+			for (int k=0; k<n; k+=1) {
+				if (ids[k] < 0 || ids[k] >= numVerts) return NULL;
+			}
+			for (int k=1; k+1<n; k+=1) {
+				faces.push_back(vec3(ids[0], ids[k], ids[k+1]));
+			}
+		}
+		return p;
+	}
+
+	vector<int> ids;
+	for (long long f=0; f<e.count; f+=1) {
+		for (int i=0; i<e.props.size(); i+=1) {
+			const ply_property& prop = e.props[i];
+			if (!prop.list) {
+				if (end-p < PLY_SIZE[prop.type]) return NULL;
+				p += PLY_SIZE[prop.type];
+				continue;
+			}
+			if (end-p < PLY_SIZE[prop.count_type]) return NULL;
+			long long n = (long long)read_value(p, prop.count_type, swap);
+			p += PLY_SIZE[prop.count_type];
+			if (n < 0 || end-p < n*PLY_SIZE[prop.type]) return NULL;
+			if (i == list) {
+				if (n < 3) return NULL;
+				ids.resize(n);
+				for (int k=0; k<n; k+=1) {
+					ids[k] = (int)read_value(p + k*PLY_SIZE[prop.type], prop.type, swap);
+					if (ids[k] < 0 || ids[k] >= numVerts) return NULL;
+				}
+				for (int k=1; k+1<n; k+=1) {
+					faces.push_back(vec3(ids[0], ids[k], ids[k+1]));
+				}
+			}
+			p += n*PLY_SIZE[prop.type];
+		}
+	}
+	return p;
+}
+
+bool
+readPLY(const char* filename, vector<vertex>& vertices, vector<vec3>& faces,
+		int threads, load_stats* stats) {
+	double start = wall_time();
+	mapped_file file;
+	if (!file.open(filename)) {
+		cout << "Unable to open file " << filename << endl;
+		return false;
+	}
+	const char* p = file.data;
+	const char* end = file.data + file.size;
+
+	vector<ply_element> elements;
+	bool swap = false;
+	if (!parse_header(p, end, elements, swap)) {
+		cout << "Unsupported PLY header in " << filename << " (binary PLY only)" << endl;
+		return false;
+	}
+
+	vertices.clear();
+	faces.clear();
+	bool haveVerts = false, haveFaces = false;
+	for (int i=0; p && i<elements.size(); i+=1) {
+		const ply_element& e = elements[i];
+		if (e.name == "vertex") {
+			p = read_vertices(p, end, e, swap, threads, vertices);
+			haveVerts = true;
+		} else if (e.name == "face" && haveVerts) {
+			p = read_faces(p, end, e, swap, vertices.size(), faces);
+			haveFaces = true;
+		} else if (e.stride() >= 0) {
+			p = (end-p < e.count*e.stride()) ? NULL : p + e.count*e.stride();
+		} else {
+			for (long long r=0; p && r<e.count; r+=1) {
+				p = skip_record(p, end, e, swap);
+			}
+		}
+	}
+	if (!p || !haveVerts || !haveFaces) {
+		cout << "Malformed PLY file " << filename << endl;
+		return false;
+	}
+
+	if (stats) {
+		*stats = load_stats();
+		stats->bytes = file.size;
+		stats->threads = max(threads, 1);
+		stats->parse_seconds = wall_time() - start;
+	}
+	return true;
+}
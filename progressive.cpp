@@ -0,0 +1,227 @@
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+#include "mesh.h"
+#include "loader.h"
+
+using namespace std;
+
+/** Progressive mesh file: the complete vertex array including every
+ * vertex appended by a collapse, the half-edge vertices of every face at
+ * full detail, and the collapse records with half-edges encoded by their
+ * index. Loading it restores every level of detail with no quadric work;
+ * the loaded mesh has an empty queue, so it cannot be simplified past
+ * the last stored collapse. */
+
+const char PM_MAGIC[4] = {'M','S','H','P'};
+const uint32_t PM_VERSION = 1;
+const uint32_t PM_VERTEX_FLOATS = 16; // position, normal, Q[10]
+
+struct pm_header {
+	char magic[4];
+	uint32_t version;
+	uint32_t num_verts;
+	uint32_t num_half_edges;
+	uint32_t num_collapses;
+	uint32_t level_of_detail;
+	uint32_t vertex_floats;
+	uint32_t reserved;
+};
+
+/* Fixed part of a collapse record, followed by the removed, fromV1,
+ * fromV2 and changedVerts half-edge indices and the newVerts ids */
+struct pm_collapse {
+	int32_t V1;
+	int32_t V2;
+	int32_t collapseVert;
+	uint32_t num_removed;
+	uint32_t num_fromV1;
+	uint32_t num_fromV2;
+	uint32_t num_newVerts;
+};
+
+static bool
+write_indices(FILE* out, const vector<int>& hes) {
+	return hes.empty() || fwrite(&hes[0], sizeof(int32_t), hes.size(), out) == hes.size();
+}
+
+bool
+Mesh::write_progressive(const char* filename) {
+	/* Records are stored relative to full detail */
+	int lod = level_of_detail;
+	upLevelOfDetail(lod);
+
+	FILE* out = fopen(filename, "wb");
+	if (!out) {
+		downLevelOfDetail(lod);
+		cout << "Unable to open file " << filename << endl;
+		return false;
+	}
+
+	pm_header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, PM_MAGIC, 4);
+	header.version = PM_VERSION;
+	header.num_verts = verts.size();
+	header.num_half_edges = edges.size();
+	header.num_collapses = collapse_list.size();
+	header.level_of_detail = lod;
+	header.vertex_floats = PM_VERTEX_FLOATS;
+	bool ok = fwrite(&header, sizeof(header), 1, out) == 1;
+
+	vector<float> vbuf;
+	vbuf.reserve(verts.size()*PM_VERTEX_FLOATS);
+	for (int i=0; i<verts.size(); i+=1) {
+		vbuf.insert(vbuf.end(), &verts[i].position[0], &verts[i].position[0]+3);
+		vbuf.insert(vbuf.end(), &verts[i].normal[0], &verts[i].normal[0]+3);
+		vbuf.insert(vbuf.end(), verts[i].Q.q, verts[i].Q.q+10);
+	}
+	ok = ok && (vbuf.empty() || fwrite(&vbuf[0], sizeof(float), vbuf.size(), out) == vbuf.size());
+
+	vector<int32_t> hebuf(edges.size());
+	for (int i=0; i<edges.size(); i+=1) {
+		hebuf[i] = edges[i].v;
+	}
+	ok = ok && (hebuf.empty() || fwrite(&hebuf[0], sizeof(int32_t), hebuf.size(), out) == hebuf.size());
+
+	for (int i=0; ok && i<collapse_list.size(); i+=1) {
+		edge_collapse& ec = collapse_list[i];
+		pm_collapse rec;
+		rec.V1 = ec.V1;
+		rec.V2 = ec.V2;
+		rec.collapseVert = ec.collapseVert;
+		rec.num_removed = ec.removed.size();
+		rec.num_fromV1 = ec.fromV1.size();
+		rec.num_fromV2 = ec.fromV2.size();
+		rec.num_newVerts = ec.newVerts.size();
+		ok = fwrite(&rec, sizeof(rec), 1, out) == 1
+			&& write_indices(out, ec.removed)
+			&& write_indices(out, ec.fromV1)
+			&& write_indices(out, ec.fromV2)
+			&& write_indices(out, ec.changedVerts)
+			&& (ec.newVerts.empty() ||
+				fwrite(&ec.newVerts[0], sizeof(int32_t), ec.newVerts.size(), out) == ec.newVerts.size());
+	}
+	ok = (fclose(out) == 0) && ok;
+
+	downLevelOfDetail(lod);
+	if (!ok) {
+		remove(filename);
+		cout << "Unable to write progressive mesh " << filename << endl;
+	}
+	return ok;
+}
+
+/* Bounds checked cursor over the mapped file */
+struct pm_reader {
+	const char* p;
+	const char* end;
+	bool ok;
+	const void* take(size_t bytes) {
+		if (!ok || (size_t)(end-p) < bytes) {
+			ok = false;
+			return NULL;
+		}
+		const void* res = p;
+		p += bytes;
+		return res;
+	}
+};
+
+/* Reads [n] indices, each of which must be in [0, limit) */
+static bool
+read_indices(pm_reader& in, uint32_t n, uint32_t limit, vector<int>& res) {
+	const int32_t* idx = (const int32_t*)in.take(n*sizeof(int32_t));
+	if (!idx) return false;
+	res.resize(n);
+	for (uint32_t i=0; i<n; i+=1) {
+		if (idx[i] < 0 || (uint32_t)idx[i] >= limit) return false;
+		res[i] = idx[i];
+	}
+	return true;
+}
+
+Mesh*
+Mesh::read_progressive(const char* filename) {
+	mapped_file file;
+	if (!file.open(filename)) {
+		cout << "Unable to open file " << filename << endl;
+		return NULL;
+	}
+	pm_reader in;
+	in.p = file.data;
+	in.end = file.data + file.size;
+	in.ok = true;
+
+	const pm_header* header = (const pm_header*)in.take(sizeof(pm_header));
+	if (!header || memcmp(header->magic, PM_MAGIC, 4) != 0 ||
+		header->version != PM_VERSION || header->vertex_floats != PM_VERTEX_FLOATS ||
+		header->num_half_edges % 3 != 0 || header->level_of_detail > header->num_collapses) {
+		cout << filename << " is not a progressive mesh file" << endl;
+		return NULL;
+	}
+
+	Mesh* mesh = new Mesh();
+	const float* vdata = (const float*)in.take(header->num_verts*(size_t)PM_VERTEX_FLOATS*sizeof(float));
+	const int32_t* hedata = (const int32_t*)in.take(header->num_half_edges*sizeof(int32_t));
+	if (!in.ok) {
+		delete mesh;
+		cout << "Truncated progressive mesh " << filename << endl;
+		return NULL;
+	}
+
+	mesh->verts.resize(header->num_verts);
+	for (int i=0; i<header->num_verts; i+=1) {
+		const float* f = vdata + i*(size_t)PM_VERTEX_FLOATS;
+		mesh->verts[i].position = vec3(f[0], f[1], f[2]);
+		mesh->verts[i].normal = vec3(f[3], f[4], f[5]);
+		memcpy(mesh->verts[i].Q.q, f+6, 10*sizeof(float));
+	}
+
+	/* Faces only need their vertices to step through the stored
+	 * collapses */
+	uint32_t nv = header->num_verts;
+	mesh->edges.resize(header->num_half_edges);
+	for (int i=0; i<header->num_half_edges; i+=1) {
+		half_edge& he = mesh->edges[i];
+		if (hedata[i] < 0 || (uint32_t)hedata[i] >= nv) {
+			in.ok = false;
+			break;
+		}
+		he.v = hedata[i];
+		he.sym = -1;
+		he.edge = -1;
+	}
+	mesh->removed.assign(header->num_half_edges/3, false);
+
+	mesh->collapse_list.resize(header->num_collapses);
+	for (int i=0; in.ok && i<header->num_collapses; i+=1) {
+		edge_collapse& ec = mesh->collapse_list[i];
+		const pm_collapse* rec = (const pm_collapse*)in.take(sizeof(pm_collapse));
+		if (!rec) break;
+		if (rec->V1 < 0 || (uint32_t)rec->V1 >= nv || rec->V2 < 0 || (uint32_t)rec->V2 >= nv ||
+			rec->collapseVert < 0 || (uint32_t)rec->collapseVert >= nv) {
+			in.ok = false;
+			break;
+		}
+		ec.V1 = rec->V1;
+		ec.V2 = rec->V2;
+		ec.collapseVert = rec->collapseVert;
+		uint32_t n = header->num_half_edges;
+		in.ok = read_indices(in, rec->num_removed, n, ec.removed)
+			&& read_indices(in, rec->num_fromV1, n, ec.fromV1)
+			&& read_indices(in, rec->num_fromV2, n, ec.fromV2)
+			&& read_indices(in, rec->num_newVerts, n, ec.changedVerts)
+			&& read_indices(in, rec->num_newVerts, nv, ec.newVerts);
+	}
+	if (!in.ok) {
+		delete mesh;
+		cout << "Corrupt progressive mesh " << filename << endl;
+		return NULL;
+	}
+
+	mesh->numIndices = header->num_half_edges;
+	mesh->live_faces = header->num_half_edges/3;
+	mesh->downLevelOfDetail(header->level_of_detail);
+	return mesh;
+}
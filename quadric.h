@@ -0,0 +1,322 @@
+#ifndef QUADRIC_H
+#define QUADRIC_H
+
+#include <glm/glm.hpp>
+#include <cstring>
+
+#if defined(__SSE__) && !defined(QUADRIC_SCALAR)
+#define QUADRIC_SSE
+#include <xmmintrin.h>
+#endif
+
+/********* Plane quadric of Garland and Heckbert ***********/
+
+/* The symmetric 4x4 error quadric, stored as its upper triangle
+ *
+ *     a b c d
+ *       e f g
+ *         h i
+ *           j
+ *
+ * in q[0..9], padded with two zeros to three aligned groups of four so
+ * that adding, solving and evaluating work on whole SSE registers. The
+ * scalar versions do the same operations lane by lane, in the same
+ * order, so both give bit-identical results; define QUADRIC_SCALAR to
+ * build without SSE.
+ *
+ * S is float or double. Float quadrics have SSE kernels; doubles keep
+ * precision on large meshes, where float sums of many planes lose the
+ * small differences the solve depends on. */
+template <class S>
+struct basic_quadric {
+	typedef glm::detail::tvec3<S> point;
+	typedef glm::detail::tvec4<S> plane;
+	alignas(16) S q[12];
+
+	basic_quadric() {
+		for (int k=0; k<12; k+=1) q[k] = 0;
+	}
+	/* p p^T for the plane p.xyz . x + p.w = 0 */
+	explicit basic_quadric(const plane& p) {
+		int index = 0;
+		for (int x=0; x<4; x+=1) {
+			for (int y=x; y<4; y+=1) {
+				q[index++] = p[x]*p[y];
+			}
+		}
+		q[10] = q[11] = 0;
+	}
+	/* Rounds or widens every entry */
+	template <class S2>
+	explicit basic_quadric(const basic_quadric<S2>& o) {
+		for (int k=0; k<12; k+=1) q[k] = o.q[k];
+	}
+	S& operator[](int k) { return q[k]; }
+	S operator[](int k) const { return q[k]; }
+
+	basic_quadric& operator+=(const basic_quadric& o) { return add_scalar(o); }
+	/* Error of placing a vertex at [v] */
+	S evaluate(const point& v) const { return evaluate_scalar(v); }
+	/* Determinant of the upper left 3x3 block; when it is non-zero, [v]
+	 * is set to the point of least error */
+	S solve(point& v) const { return solve_scalar(v); }
+
+	basic_quadric& add_scalar(const basic_quadric& o);
+	S evaluate_scalar(const point& v) const;
+	S solve_scalar(point& v) const;
+#ifdef QUADRIC_SSE
+	/* float only */
+	basic_quadric& add_sse(const basic_quadric& o);
+	S evaluate_sse(const point& v) const;
+	S solve_sse(point& v) const;
+#endif
+};
+
+typedef basic_quadric<float> quadric;
+typedef basic_quadric<double> quadric_d;
+
+template <class S>
+inline basic_quadric<S>
+operator+(basic_quadric<S> a, const basic_quadric<S>& b) {
+	return a += b;
+}
+
+template <class S>
+inline basic_quadric<S>&
+basic_quadric<S>::add_scalar(const basic_quadric& o) {
+	for (int k=0; k<12; k+=1) q[k] += o.q[k];
+	return *this;
+}
+
+/* Sum of q[k]*m[k] over the monomials
+ *   m = x^2 2xy 2xz 2x | y^2 2yz 2y z^2 | 2z 1 0 0
+ * taken lane-wise over the three groups, then across the lanes. T is a
+ * float, or a vector of floats holding one quadric per element. */
+template <class T>
+inline T
+quadric_evaluate(const T* q, T x, T y, T z) {
+	T x2 = x+x, y2 = y+y, z2 = z+z;
+	T s0 = (q[0]*(x*x) + q[4]*(y*y)) + q[8]*z2;
+	T s1 = (q[1]*(x2*y) + q[5]*(y2*z)) + q[9];
+	T s2 = (q[2]*(x2*z) + q[6]*y2) + 0.0f;
+	T s3 = (q[3]*x2 + q[7]*(z*z)) + 0.0f;
+	return (s0+s2) + (s1+s3);
+}
+
+/* The 3x3 block is symmetric, so its adjugate is made of the cross
+ * products of its rows: x = -adj (d g i) / det. Sets [v] whatever the
+ * determinant, so a zero one leaves infinities there. */
+template <class T>
+inline T
+quadric_solve(const T* q, T* v) {
+	T a = q[0], b = q[1], c = q[2], e = q[4], f = q[5], h = q[7];
+	/* rows (a b c), (b e f), (c f h); cN = row N+1 x row N+2 */
+	T c0x = e*h - f*f, c0y = f*c - b*h, c0z = b*f - e*c;
+	T c1x = f*c - h*b, c1y = h*a - c*c, c1z = c*b - f*a;
+	T c2x = b*f - c*e, c2y = c*b - a*f, c2z = a*e - b*b;
+	T det = (a*c0x + b*c0y) + c*c0z;
+	v[0] = -(((c0x*q[3] + c1x*q[6]) + c2x*q[8]) / det);
+	v[1] = -(((c0y*q[3] + c1y*q[6]) + c2y*q[8]) / det);
+	v[2] = -(((c0z*q[3] + c1z*q[6]) + c2z*q[8]) / det);
+	return det;
+}
+
+template <class S>
+inline S
+basic_quadric<S>::evaluate_scalar(const point& v) const {
+	return quadric_evaluate<S>(q, v.x, v.y, v.z);
+}
+
+template <class S>
+inline S
+basic_quadric<S>::solve_scalar(point& v) const {
+	S p[3];
+	S det = quadric_solve<S>(q, p);
+	if (det != 0) v = point(p[0], p[1], p[2]);
+	return det;
+}
+
+#ifdef QUADRIC_SSE
+
+template <>
+inline quadric&
+quadric::add_sse(const quadric& o) {
+	_mm_store_ps(q, _mm_add_ps(_mm_load_ps(q), _mm_load_ps(o.q)));
+	_mm_store_ps(q+4, _mm_add_ps(_mm_load_ps(q+4), _mm_load_ps(o.q+4)));
+	_mm_store_ps(q+8, _mm_add_ps(_mm_load_ps(q+8), _mm_load_ps(o.q+8)));
+	return *this;
+}
+
+template <>
+inline float
+quadric::evaluate_sse(const glm::vec3& v) const {
+	float x = v.x, y = v.y, z = v.z;
+	float x2 = x+x, y2 = y+y, z2 = z+z;
+	__m128 m0 = _mm_setr_ps(x*x, x2*y, x2*z, x2);
+	__m128 m1 = _mm_setr_ps(y*y, y2*z, y2, z*z);
+	__m128 m2 = _mm_setr_ps(z2, 1, 0, 0);
+	__m128 s = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_load_ps(q), m0),
+	                                 _mm_mul_ps(_mm_load_ps(q+4), m1)),
+	                      _mm_mul_ps(_mm_load_ps(q+8), m2));
+	s = _mm_add_ps(s, _mm_movehl_ps(s, s));                    // s0+s2, s1+s3
+	s = _mm_add_ss(s, _mm_shuffle_ps(s, s, _MM_SHUFFLE(1,1,1,1)));
+	return _mm_cvtss_f32(s);
+}
+
+/* yzx and zxy rotations of the first three lanes */
+#define QUADRIC_YZX(a) _mm_shuffle_ps(a, a, _MM_SHUFFLE(3,0,2,1))
+#define QUADRIC_ZXY(a) _mm_shuffle_ps(a, a, _MM_SHUFFLE(3,1,0,2))
+
+static inline __m128
+quadric_cross(__m128 a, __m128 b) {
+	return _mm_sub_ps(_mm_mul_ps(QUADRIC_YZX(a), QUADRIC_ZXY(b)),
+	                  _mm_mul_ps(QUADRIC_ZXY(a), QUADRIC_YZX(b)));
+}
+
+template <>
+inline float
+quadric::solve_sse(glm::vec3& v) const {
+	__m128 v0 = _mm_load_ps(q);    // a b c d
+	__m128 v1 = _mm_load_ps(q+4);  // e f g h
+	__m128 v2 = _mm_load_ps(q+8);  // i j 0 0
+	__m128 r0 = v0;
+	__m128 t = _mm_shuffle_ps(v0, v1, _MM_SHUFFLE(1,0,1,1));     // b b e f
+	__m128 r1 = _mm_shuffle_ps(t, t, _MM_SHUFFLE(3,3,2,0));      // b e f f
+	t = _mm_shuffle_ps(v0, v1, _MM_SHUFFLE(3,1,2,2));            // c c f h
+	__m128 r2 = _mm_shuffle_ps(t, t, _MM_SHUFFLE(3,3,2,0));      // c f h h
+	__m128 c0 = quadric_cross(r1, r2);
+	__m128 c1 = quadric_cross(r2, r0);
+	__m128 c2 = quadric_cross(r0, r1);
+
+	__m128 p = _mm_mul_ps(r0, c0);
+	__m128 det = _mm_add_ss(_mm_add_ss(p, _mm_shuffle_ps(p, p, _MM_SHUFFLE(1,1,1,1))),
+	                        _mm_shuffle_ps(p, p, _MM_SHUFFLE(2,2,2,2)));
+	float d = _mm_cvtss_f32(det);
+	if (d != 0) {
+		__m128 n = _mm_add_ps(_mm_add_ps(
+			_mm_mul_ps(c0, _mm_shuffle_ps(v0, v0, _MM_SHUFFLE(3,3,3,3))),
+			_mm_mul_ps(c1, _mm_shuffle_ps(v1, v1, _MM_SHUFFLE(2,2,2,2)))),
+			_mm_mul_ps(c2, _mm_shuffle_ps(v2, v2, _MM_SHUFFLE(0,0,0,0))));
+		n = _mm_div_ps(n, _mm_shuffle_ps(det, det, _MM_SHUFFLE(0,0,0,0)));
+		alignas(16) float out[4];
+		_mm_store_ps(out, n);
+		v = glm::vec3(-out[0], -out[1], -out[2]);
+	}
+	return d;
+}
+
+#undef QUADRIC_YZX
+#undef QUADRIC_ZXY
+
+template <> inline quadric& quadric::operator+=(const quadric& o) { return add_sse(o); }
+template <> inline float quadric::evaluate(const glm::vec3& v) const { return evaluate_sse(v); }
+template <> inline float quadric::solve(glm::vec3& v) const { return solve_sse(v); }
+
+#endif //QUADRIC_SSE
+
+/* Smallest determinant for which the point of least error is trusted;
+ * below it the quadric is taken as singular */
+const float QUADRIC_MIN_DET = 0.01f;
+
+/********* Many quadrics solved at once ***********/
+
+/* Bytes in the widest vector register the build targets: plain x86-64
+ * gets 16 (4 float or 2 double SSE lanes). Build with -mavx2 or
+ * -mavx512f (make ARCH=-march=native) for 32 or 64. */
+#if defined(__AVX512F__) && !defined(QUADRIC_SCALAR)
+#define QUADRIC_VECTOR_BYTES 64
+#elif defined(__AVX__) && !defined(QUADRIC_SCALAR)
+#define QUADRIC_VECTOR_BYTES 32
+#else
+#define QUADRIC_VECTOR_BYTES 16
+#endif
+
+/* Quadrics per batch, a multiple of the lanes. A whole block is
+ * gathered before any of it is loaded back as vectors, so the scalar
+ * stores have reached the cache rather than stalling the loads. */
+const int QUADRIC_BATCH = 64;
+
+/* Integer of the same width as S, for lane masks */
+template <class S> struct quadric_int;
+template <> struct quadric_int<float> { typedef int type; };
+template <> struct quadric_int<double> { typedef long long type; };
+
+/* Quadrics laid out one entry per row, one quadric per column, so each
+ * row loads as vectors and every instruction of quadric_solve and
+ * quadric_evaluate works on LANES of them. Each one either takes its
+ * point of least error or, when [solve] is clear or the quadric is
+ * singular, its [fixed] point; the choice is a mask, not a branch. */
+template <class S>
+struct basic_quadric_batch {
+	typedef typename quadric_int<S>::type mask_int;
+	static const int LANES = QUADRIC_VECTOR_BYTES/sizeof(S);
+
+	alignas(64) S q[10][QUADRIC_BATCH];
+	alignas(64) S fixed[3][QUADRIC_BATCH];
+	alignas(64) mask_int solve[QUADRIC_BATCH]; // -1 to allow the optimum, else 0
+	alignas(64) S point[3][QUADRIC_BATCH];
+	alignas(64) S cost[QUADRIC_BATCH];
+
+	/* Entry [i] is the sum of two quadrics, added straight into place
+	 * in S whatever they are stored as */
+	template <class S2>
+	void set(int i, const basic_quadric<S2>& A, const basic_quadric<S2>& B, const glm::vec3& p, bool free) {
+		for (int k=0; k<10; k+=1) q[k][i] = (S)A.q[k] + (S)B.q[k];
+		for (int k=0; k<3; k+=1) fixed[k][i] = p[k];
+		solve[i] = free ? -1 : 0;
+	}
+	glm::vec3 merge_point(int i) const {
+		return glm::vec3(point[0][i], point[1][i], point[2][i]);
+	}
+	/* Fills point and cost of the first [n] entries */
+	void evaluate(int n);
+};
+
+typedef basic_quadric_batch<float> quadric_batch;
+typedef basic_quadric_batch<double> quadric_batch_d;
+
+#ifdef QUADRIC_SCALAR
+
+template <class S>
+inline void
+basic_quadric_batch<S>::evaluate(int n) {
+	for (int i=0; i<n; i+=1) {
+		S Q[10], p[3];
+		for (int k=0; k<10; k+=1) Q[k] = q[k][i];
+		S det = quadric_solve<S>(Q, p);
+		bool use = solve[i] && det >= QUADRIC_MIN_DET;
+		for (int k=0; k<3; k+=1) point[k][i] = use ? p[k] : fixed[k][i];
+		cost[i] = quadric_evaluate<S>(Q, point[0][i], point[1][i], point[2][i]);
+	}
+}
+
+#else
+
+template <class S>
+inline void
+basic_quadric_batch<S>::evaluate(int n) {
+	typedef S lanes __attribute__((vector_size(QUADRIC_VECTOR_BYTES)));
+	typedef mask_int mask __attribute__((vector_size(QUADRIC_VECTOR_BYTES)));
+	for (int i=n; i%LANES != 0; i+=1) {
+		set(i, basic_quadric<S>(), basic_quadric<S>(), glm::vec3(0), false); // unused lanes of the last vector
+	}
+	for (int i=0; i<n; i+=LANES) {
+		lanes Q[10], p[3], f[3], c;
+		mask free;
+		for (int k=0; k<10; k+=1) memcpy(&Q[k], &q[k][i], sizeof(Q[k]));
+		for (int k=0; k<3; k+=1) memcpy(&f[k], &fixed[k][i], sizeof(f[k]));
+		memcpy(&free, &solve[i], sizeof(free));
+		lanes det = quadric_solve<lanes>(Q, p);
+		mask use = free & (det >= (S)QUADRIC_MIN_DET);
+		for (int k=0; k<3; k+=1) {
+			p[k] = use ? p[k] : f[k];
+			memcpy(&point[k][i], &p[k], sizeof(p[k]));
+		}
+		c = quadric_evaluate<lanes>(Q, p[0], p[1], p[2]);
+		memcpy(&cost[i], &c, sizeof(c));
+	}
+}
+
+#endif //QUADRIC_SCALAR
+
+#endif //QUADRIC_H
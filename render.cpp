@@ -0,0 +1,49 @@
+#include <GLUT/glut.h>
+#include "mesh.h"
+
+using namespace std;
+
+/** GL side of the Mesh, kept apart so the simplification core builds
+ * and runs without GL or a display **/
+
+#define BUFFER_OFFSET(i) (reinterpret_cast<void*>(i))
+
+void
+Mesh::init_buffers() {
+  glGenBuffers(1, &arrayBuffer);
+  glGenBuffers(1, &elementArrayBuffer);
+  update_buffer();
+}
+
+void
+Mesh::update_buffer() {
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, NULL);
+	
+	vector<GLuint> elements;
+	for (int i=0; i<edges.size(); i+=1) {
+		if (!removed[i/3]) {
+			elements.push_back(edges[i].v);
+		}
+	}
+	
+	cout << "Triangles: " << elements.size()/3 << endl;
+	numIndices = elements.size();
+	
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementArrayBuffer);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint)*elements.size(), &elements[0], GL_STATIC_DRAW);
+	if (max_lod < level_of_detail){
+		max_lod = level_of_detail;
+		vector<vertex_data> vertdata;
+		for (int i=0; i<verts.size(); i+=1){
+			vertdata.push_back(verts[i].data());
+		}
+		glBindBuffer(GL_ARRAY_BUFFER, NULL);
+		glBindBuffer(GL_ARRAY_BUFFER, arrayBuffer);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(vertex_data)*vertdata.size(), &vertdata[0], GL_STATIC_DRAW);
+	}
+}
+
+void
+Mesh::draw() {
+	glDrawElements(GL_TRIANGLES, numIndices, GL_UNSIGNED_INT, BUFFER_OFFSET(0));
+}
@@ -0,0 +1,142 @@
+/*************************************************************************/
+/*   Headless simplifier: the collapse engine without GL or a display   */
+/*************************************************************************/
+
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include "mesh.h"
+#include "loader.h"
+#include "stream.h"
+#include "threadpool.h"
+#include "timer.h"
+
+using namespace std;
+
+static void
+usage() {
+	cerr << "usage: simplify [-j threads] [-precision P] [-lazy] [-sample K [-seed S] | -parallel]\n"
+		 << "                (-faces N | -ratio R) [-error E] <input> <output.off>\n"
+		 << "       simplify [-precision P] [-lazy] [-sample K [-seed S]] -ratio R -mem MB <input.off> <output.off>\n"
+		 << "  -faces N   stop at N faces\n"
+		 << "  -ratio R   stop at R times the input faces\n"
+		 << "  -error E   stop before the first collapse costing more than E\n"
+		 << "  -mem MB    simplify out of core within MB of memory\n"
+		 << "  -precision float|mixed|double\n"
+		 << "             quadric arithmetic: float, float quadrics solved in\n"
+		 << "             double, or double quadrics throughout (default float)\n"
+		 << "  -lazy      re-evaluate the edges around a collapse only when\n"
+		 << "             they reach the top of the queue\n"
+		 << "  -sample K  collapse the cheapest of K random edges at a time\n"
+		 << "             instead of the cheapest of all; faster, a little worse\n"
+		 << "  -seed S    random seed for -sample (default 1)\n"
+		 << "  -parallel  collapse edges that lie apart in rounds on the -j\n"
+		 << "             threads\n";
+	exit(1);
+}
+
+int main(int argc, char* argv[]) {
+	int threads = hardware_threads();
+	int target = -1;
+	double ratio = -1;
+	float max_error = FLT_MAX;
+	double memory_mb = 0;
+	quadric_precision precision = FLOAT_QUADRICS;
+	bool lazy = false;
+	int sample = 0;
+	bool parallel = false;
+	unsigned long long seed = 1;
+	char* input = NULL;
+	char* output = NULL;
+	for (int i=1; i<argc; i+=1) {
+		if (!strcmp(argv[i], "-j") && i+1 < argc) {
+			threads = max(1, atoi(argv[++i]));
+		} else if (!strcmp(argv[i], "-faces") && i+1 < argc) {
+			target = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-ratio") && i+1 < argc) {
+			ratio = atof(argv[++i]);
+		} else if (!strcmp(argv[i], "-error") && i+1 < argc) {
+			max_error = atof(argv[++i]);
+		} else if (!strcmp(argv[i], "-mem") && i+1 < argc) {
+			memory_mb = atof(argv[++i]);
+		} else if (!strcmp(argv[i], "-precision") && i+1 < argc) {
+			i += 1;
+			if (!strcmp(argv[i], "float")) precision = FLOAT_QUADRICS;
+			else if (!strcmp(argv[i], "mixed")) precision = MIXED_QUADRICS;
+			else if (!strcmp(argv[i], "double")) precision = DOUBLE_QUADRICS;
+			else usage();
+		} else if (!strcmp(argv[i], "-lazy")) {
+			lazy = true;
+		} else if (!strcmp(argv[i], "-sample") && i+1 < argc) {
+			sample = atoi(argv[++i]);
+			if (sample < 1) usage();
+		} else if (!strcmp(argv[i], "-seed") && i+1 < argc) {
+			seed = strtoull(argv[++i], NULL, 10);
+		} else if (!strcmp(argv[i], "-parallel")) {
+			parallel = true;
+		} else if (!input) {
+			input = argv[i];
+		} else if (!output) {
+			output = argv[i];
+		} else {
+			usage();
+		}
+	}
+	if (!input || !output || (target < 0 && ratio < 0 && max_error == FLT_MAX) || (sample > 0 && parallel)) {
+		usage();
+	}
+
+	if (memory_mb > 0) {
+		if (ratio <= 0 || ratio > 1 || parallel) usage();
+		stream_options opts;
+		opts.ratio = ratio;
+		opts.memory_bytes = (size_t)(memory_mb*1024*1024);
+		opts.precision = precision;
+		opts.lazy = lazy;
+		opts.sample = sample;
+		opts.seed = seed;
+		return streamSimplify(input, output, opts) ? 0 : 1;
+	}
+
+	/* The cache is skipped: render nodes often read from shared,
+	 * read-only archives */
+	double start = wall_time();
+	vector<vertex> vertices;
+	vector<vec3> faces;
+	load_stats stats;
+	if (!readMeshFile(input, vertices, faces, threads, &stats)) {
+		return 1;
+	}
+	double parsed = wall_time();
+	mesh_transform transform;
+	prepareMesh(vertices, faces, threads, &transform);
+	Mesh mesh(vertices, faces, threads, precision);
+	mesh.lazy = lazy;
+	double built = wall_time();
+
+	int inputFaces = mesh.face_count();
+	if (ratio >= 0) {
+		target = max(target, (int)ceil(inputFaces*ratio));
+	}
+	if (sample > 0) {
+		mesh.simplify_sampled(max(target, 0), sample, seed, max_error);
+	} else if (parallel) {
+		mesh.simplify_parallel(max(target, 0), threads, max_error);
+	} else {
+		mesh.simplify(max(target, 0), max_error);
+	}
+	double simplified = wall_time();
+
+	if (!mesh.write_off(output, transform.middle, 1.0f/transform.scale)) {
+		return 1;
+	}
+	double written = wall_time();
+
+	cout << "Load:     " << (parsed-start)*1000 << " ms" << endl;
+	cout << "Prepare:  " << (built-parsed)*1000 << " ms" << endl;
+	cout << "Simplify: " << (simplified-built)*1000 << " ms" << endl;
+	cout << "Write:    " << (written-simplified)*1000 << " ms" << endl;
+	cout << "Triangles: " << inputFaces << " -> " << mesh.face_count() << endl;
+	return 0;
+}
@@ -0,0 +1,671 @@
+#include <iostream>
+#include <algorithm>
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+#include "mesh.h"
+#include "loader.h"
+#include "stream.h"
+#include "timer.h"
+
+using namespace std;
+
+/* Peak resident cost of one face of a window: its half-edges, edge
+ * records and queue, the collapses it records, and the vertex and face
+ * arrays it is built from. Measured at about 515 bytes on narrow windows
+ * of a grid, which have the most vertices per face. */
+const size_t BYTES_PER_FACE = 576;
+/* Half a vertex's double quadric, with DOUBLE_QUADRICS */
+const size_t DOUBLE_BYTES_PER_FACE = sizeof(quadric_d)/2;
+const int BINS = 4096;          // bins along the longest axis
+const int ROW_BINS = 1024;      // bins along the second longest
+/* Share of the budget for pages of the input and scratch files; the
+ * rest holds the window being simplified */
+const int PAGE_SHARE = 4;
+const int CHECK_EVERY = 32;     // records between looks at the resident set
+const int MAX_PASSES = 4;       // sweeps over the windows, alternately shifted
+
+/* Tags in the per-vertex window table */
+const int UNUSED = -1;
+const int SHARED = -2;          // used by several windows, not yet written
+const int EMITTED = -3;         // EMITTED-id: shared and written as output vertex id
+
+stream_options::stream_options() : ratio(0.1), memory_bytes(256 << 20), precision(FLOAT_QUADRICS), lazy(false),
+	sample(0), seed(1) {}
+
+/* Drops the pages of [bytes] at [p] from the resident set. They belong
+ * to files, so their contents stay there and are faulted back in when
+ * touched again */
+static void
+release_pages(const void* p, size_t bytes) {
+	if (!p || !bytes) return;
+	uintptr_t page = sysconf(_SC_PAGESIZE);
+	uintptr_t begin = (uintptr_t)p & ~(page-1);
+	uintptr_t end = ((uintptr_t)p + bytes + page-1) & ~(page-1);
+	madvise((void*)begin, end-begin, MADV_DONTNEED);
+}
+
+/* Pages of mapped files now resident, from /proc/self/statm, or the
+ * page faults taken so far where that is missing */
+static long
+mapped_pages() {
+	static int fd = ::open("/proc/self/statm", O_RDONLY);
+	char buf[128];
+	ssize_t n = fd < 0 ? -1 : pread(fd, buf, sizeof(buf)-1, 0);
+	long size, resident, shared;
+	if (n > 0) {
+		buf[n] = 0;
+		if (sscanf(buf, "%ld %ld %ld", &size, &resident, &shared) == 3) return shared;
+	}
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_minflt + usage.ru_majflt;
+}
+
+/* Keeps the resident pages of the input and scratch files within a
+ * limit. The sweeps over them call tick() once per record; every
+ * CHECK_EVERY records it looks at the resident set, and once the pages
+ * mapped since the last release pass the limit, it drops every watched
+ * range. A window is released before its mesh is built and after its
+ * result is written, so the scratch arrays are paged in window by
+ * window. */
+struct page_budget {
+	long limit;
+	long base;
+	int ticks;
+	vector<pair<const void*, size_t> > ranges;
+	page_budget(size_t bytes) : ticks(0) {
+		limit = max<long>(16, bytes / sysconf(_SC_PAGESIZE));
+		base = mapped_pages();
+	}
+	void watch(const void* p, size_t bytes) {
+		ranges.push_back(make_pair(p, bytes));
+	}
+	void tick() {
+		if (++ticks < CHECK_EVERY) return;
+		ticks = 0;
+		if (mapped_pages() - base > limit) release();
+	}
+	void release() {
+		for (int i=0; i<ranges.size(); i+=1) {
+			release_pages(ranges[i].first, ranges[i].second);
+		}
+		base = mapped_pages();
+	}
+};
+
+/* Temporary file mapped read/write; it is unlinked as soon as it is
+ * mapped, so the space is returned when the mapping is closed */
+struct scratch_file {
+	char* data;
+	size_t size;
+	scratch_file() : data(NULL), size(0) {}
+	~scratch_file() { close(); }
+	bool create(const string& name, size_t bytes) {
+		size = max(bytes, (size_t)1);
+		int fd = ::open(name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+		if (fd < 0) return false;
+		unlink(name.c_str());
+		if (ftruncate(fd, size) != 0) {
+			::close(fd);
+			return false;
+		}
+		void* p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		::close(fd);
+		if (p == MAP_FAILED) return false;
+		data = (char*)p;
+		madvise(p, size, MADV_RANDOM);
+		return true;
+	}
+	void close() {
+		if (data) munmap(data, size);
+		data = NULL;
+		size = 0;
+	}
+};
+
+/* Temporary file appended to through stdio and then mapped to be read;
+ * it is unlinked as soon as it is open, like scratch_file, and closed
+ * on every exit */
+struct scratch_stream {
+	FILE* f;
+	char* data;
+	size_t size;
+	scratch_stream() : f(NULL), data(NULL), size(0) {}
+	~scratch_stream() { close(); }
+	bool create(const string& name) {
+		close();
+		f = fopen(name.c_str(), "w+b");
+		if (f) remove(name.c_str());
+		return f != NULL;
+	}
+	bool write(const void* p, size_t bytes) {
+		return fwrite(p, 1, bytes, f) == bytes;
+	}
+	bool map() {
+		if (fflush(f) != 0 || ferror(f)) return false;
+		size = ftello(f);
+		if (size == 0) return true;
+		void* p = mmap(NULL, size, PROT_READ, MAP_SHARED, fileno(f), 0);
+		if (p == MAP_FAILED) return false;
+		data = (char*)p;
+		madvise(p, size, MADV_RANDOM);
+		return true;
+	}
+	void close() {
+		if (data) munmap(data, size);
+		if (f) fclose(f);
+		f = NULL;
+		data = NULL;
+		size = 0;
+	}
+};
+
+/* The geometry one pass reads or writes: xyz floats per vertex and
+ * vertex id triples per triangle */
+struct stream_mesh {
+	scratch_stream verts, tris;
+	int numVerts;
+	long long numTris;
+	stream_mesh() : numVerts(0), numTris(0) {}
+	bool create(const string& name) {
+		numVerts = 0;
+		numTris = 0;
+		return verts.create(name + ".verts") && tris.create(name + ".tris");
+	}
+	bool map() { return verts.map() && tris.map(); }
+	void close() {
+		verts.close();
+		tris.close();
+	}
+	const float* pos() const { return (const float*)verts.data; }
+	const int* tri() const { return (const int*)tris.data; }
+};
+
+/* The grid of bins the windows are cut from, over the two longest axes
+ * of the bounds, and the normalisation the windows are simplified in */
+struct window_layout {
+	int axis[2];
+	float lo[2], extent[2];
+	vec3 middle;
+	float scale;
+};
+
+/* Bin of a triangle's centroid along [axis], out of [bins] */
+static inline int
+centroid_bin(const float* pos, const int tri[3], int axis, float lo, float extent, int bins) {
+	float c = (pos[3*tri[0]+axis] + pos[3*tri[1]+axis] + pos[3*tri[2]+axis])/3.0f;
+	int bin = (int)((c - lo) / max(extent, 1e-20f) * bins);
+	return min(max(bin, 0), bins-1);
+}
+
+static double
+peak_memory_mb() {
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+#ifdef OSX
+	return usage.ru_maxrss/(1024.0*1024.0);
+#else
+	return usage.ru_maxrss/1024.0;
+#endif
+}
+
+/* Copies the OFF file into [mesh], fanning polygons into triangles, and
+ * finds the bounds. The input is released behind the scan. */
+static bool
+read_input(const char* input, const string& tmp, page_budget& budget, stream_mesh& mesh,
+			vec3& lo, vec3& hi) {
+	mapped_file in;
+	if (!in.open(input)) {
+		cout << "Unable to open file " << input << endl;
+		return false;
+	}
+	const char* p = in.data;
+	const char* end = in.data + in.size;
+	int numVerts, numFaces;
+	if (!(p = scan_off_header(p, end, numVerts, numFaces))) {
+		cout << "Malformed OFF header in " << input << endl;
+		return false;
+	}
+	if (!mesh.create(tmp)) {
+		cout << "Unable to create scratch files next to " << tmp << endl;
+		return false;
+	}
+	budget.ranges.clear();
+	budget.watch(in.data, in.size);
+
+	lo = vec3(1e30f);
+	hi = vec3(-1e30f);
+	for (int i=0; i<numVerts; i+=1) {
+		vertex v;
+		if (!(p = scan_vertex(p, end, v))) {
+			cout << "Malformed vertex " << i << " in " << input << endl;
+			return false;
+		}
+		p = skip_line(p, end);
+		if (!mesh.verts.write(&v.position[0], 3*sizeof(float))) {
+			cout << "Unable to write scratch files next to " << tmp << endl;
+			return false;
+		}
+		lo = glm::min(lo, v.position);
+		hi = glm::max(hi, v.position);
+		budget.tick();
+	}
+	mesh.numVerts = numVerts;
+
+	vector<int> ids;
+	for (int i=0; i<numFaces; i+=1) {
+		if (!(p = scan_polygon(p, end, numVerts, ids))) {
+			cout << "Malformed face " << i << " in " << input << endl;
+			return false;
+		}
+		p = skip_line(p, end);
+		for (int k=1; k+1<ids.size(); k+=1) {
+			int tri[3] = {ids[0], ids[k], ids[k+1]};
+			if (!mesh.tris.write(tri, sizeof(tri))) {
+				cout << "Unable to write scratch files next to " << tmp << endl;
+				return false;
+			}
+			mesh.numTris += 1;
+		}
+		budget.tick();
+	}
+	budget.ranges.clear();
+	if (!mesh.map()) {
+		cout << "Unable to map scratch files next to " << tmp << endl;
+		return false;
+	}
+	return true;
+}
+
+/* The cells of a grid of bins the windows are: slabs of bins along the
+ * first axis, all crossed by the same rows of bins along the second */
+struct window_grid {
+	vector<int> firstBin;        // slab s holds bins [firstBin[s], firstBin[s+1])
+	vector<int> firstRow;        // row r holds bins [firstRow[r], firstRow[r+1])
+	vector<int> binSlab, binRow;
+	vector<long long> count;     // faces per window, row after row of each slab
+	int window(const float* pos, const int tri[3], const window_layout& layout) const {
+		int s = binSlab[centroid_bin(pos, tri, layout.axis[0], layout.lo[0], layout.extent[0], BINS)];
+		int r = binRow[centroid_bin(pos, tri, layout.axis[1], layout.lo[1], layout.extent[1], ROW_BINS)];
+		return s*(firstRow.size()-1) + r;
+	}
+};
+
+/* Groups the bins of [hist] into runs of at most [capacity] faces,
+ * cutting only at the bins in [cuts]; a stretch between two cuts that
+ * holds more becomes a run of its own. Returns the first bin of each
+ * run, closed by the number of bins. */
+static vector<int>
+pack_bins(const vector<long long>& hist, const vector<int>& cuts, long long capacity) {
+	vector<int> first(1, 0);
+	long long faces = 0;
+	for (int c=0; c+1<cuts.size(); c+=1) {
+		long long run = 0;
+		for (int b=cuts[c]; b<cuts[c+1]; b+=1) {
+			run += hist[b];
+		}
+		if (faces > 0 && faces + run > capacity) {
+			first.push_back(cuts[c]);
+			faces = 0;
+		}
+		faces += run;
+	}
+	first.push_back(hist.size());
+	return first;
+}
+
+/* Which of the runs starting at [first] each bin falls in */
+static vector<int>
+bin_runs(const vector<int>& first) {
+	vector<int> run(first.back());
+	for (int i=0; i+1<first.size(); i+=1) {
+		fill(run.begin() + first[i], run.begin() + first[i+1], i);
+	}
+	return run;
+}
+
+/* Cuts [mesh] into windows of at most [windowFaces] faces, at the bins
+ * in [cutsA] along the first axis and [cutsB] along the second. The
+ * slabs are sized so the windows come out about as long as they are
+ * wide; the rows are packed by the fullest slab at each bin, so every
+ * window fits. */
+static void
+plan_windows(const stream_mesh& mesh, const window_layout& layout, const vector<int>& cutsA,
+				const vector<int>& cutsB, long long windowFaces, page_budget& budget, window_grid& grid) {
+	budget.ranges.clear();
+	budget.watch(mesh.verts.data, mesh.verts.size);
+	budget.watch(mesh.tris.data, mesh.tris.size);
+	const float* pos = mesh.pos();
+	const int* tris = mesh.tri();
+
+	vector<long long> hist(BINS, 0);
+	for (long long i=0; i<mesh.numTris; i+=1) {
+		hist[centroid_bin(pos, tris + 3*i, layout.axis[0], layout.lo[0], layout.extent[0], BINS)] += 1;
+		budget.tick();
+	}
+	long long numWindows = (mesh.numTris + windowFaces-1)/windowFaces;
+	double aspect = layout.extent[0]/max(layout.extent[1], layout.extent[0]*1e-6f);
+	long long numSlabs = min(numWindows, max(1LL, (long long)ceil(sqrt(numWindows*aspect))));
+	grid.firstBin = pack_bins(hist, cutsA, max(windowFaces, (mesh.numTris + numSlabs-1)/numSlabs));
+	grid.binSlab = bin_runs(grid.firstBin);
+	numSlabs = grid.firstBin.size()-1;
+
+	vector<long long> rows(numSlabs*ROW_BINS, 0);
+	for (long long i=0; i<mesh.numTris; i+=1) {
+		const int* tri = tris + 3*i;
+		int s = grid.binSlab[centroid_bin(pos, tri, layout.axis[0], layout.lo[0], layout.extent[0], BINS)];
+		rows[s*ROW_BINS + centroid_bin(pos, tri, layout.axis[1], layout.lo[1], layout.extent[1], ROW_BINS)] += 1;
+		budget.tick();
+	}
+	budget.release();
+	vector<long long> fullest(ROW_BINS, 0);
+	for (int s=0; s<numSlabs; s+=1) {
+		for (int b=0; b<ROW_BINS; b+=1) {
+			fullest[b] = max(fullest[b], rows[s*ROW_BINS + b]);
+		}
+	}
+	grid.firstRow = pack_bins(fullest, cutsB, windowFaces);
+	grid.binRow = bin_runs(grid.firstRow);
+	int numRows = grid.firstRow.size()-1;
+	grid.count.assign(numSlabs*numRows, 0);
+	for (int s=0; s<numSlabs; s+=1) {
+		for (int b=0; b<ROW_BINS; b+=1) {
+			grid.count[s*numRows + grid.binRow[b]] += rows[s*ROW_BINS + b];
+		}
+	}
+}
+
+/* Bins halfway through the runs starting at [first], closed by the
+ * number of bins: the cuts of the next pass, whose windows then cover
+ * the seams these had to keep locked */
+static vector<int>
+shifted_cuts(const vector<int>& first) {
+	vector<int> cuts(1, 0);
+	for (int i=0; i+1<first.size(); i+=1) {
+		int mid = (first[i] + first[i+1])/2;
+		if (mid > cuts.back()) cuts.push_back(mid);
+	}
+	cuts.push_back(first.back());
+	return cuts;
+}
+
+/* One sweep over the windows of [grid]. The faces of [in] are scattered
+ * into their windows; each window is then simplified to [ratio] of its
+ * faces while the vertices it shares with other windows stay locked,
+ * and its result is appended to [out] */
+static bool
+simplify_windows(const stream_mesh& in, const window_layout& layout, const window_grid& grid,
+					double ratio, int pass, const stream_options& opts, const string& tmp,
+					page_budget& budget, stream_mesh& out) {
+	int numWindows = grid.count.size();
+	vector<long long> windowStart(numWindows+1, 0);
+	for (int w=0; w<numWindows; w+=1) {
+		windowStart[w+1] = windowStart[w] + grid.count[w];
+	}
+	size_t faceBytes = BYTES_PER_FACE;
+	if (opts.precision == DOUBLE_QUADRICS) {
+		faceBytes += DOUBLE_BYTES_PER_FACE;
+	}
+	for (int w=0; w<numWindows; w+=1) {
+		if (grid.count[w]*faceBytes > opts.memory_bytes) {
+			cout << "A window holds " << grid.count[w] << " faces, more than "
+				 << opts.memory_bytes/1048576.0 << " MB allows" << endl;
+			return false;
+		}
+	}
+
+	/** Scatter faces into their windows and tag shared vertices **/
+	const float* pos = in.pos();
+	const int* tris = in.tri();
+	scratch_file faceFile, tagFile;
+	if (!faceFile.create(tmp + ".faces", (size_t)in.numTris*3*sizeof(int)) ||
+		!tagFile.create(tmp + ".tags", (size_t)in.numVerts*sizeof(int)) ||
+		!out.create(tmp + (pass%2 ? ".odd" : ".even"))) {
+		cout << "Unable to create scratch files next to " << tmp << endl;
+		return false;
+	}
+	budget.ranges.clear();
+	budget.watch(in.verts.data, in.verts.size);
+	budget.watch(in.tris.data, in.tris.size);
+	budget.watch(faceFile.data, faceFile.size);
+	budget.watch(tagFile.data, tagFile.size);
+	int* sorted = (int*)faceFile.data;
+	int* tag = (int*)tagFile.data;
+	for (int i=0; i<in.numVerts; i+=1) {
+		tag[i] = UNUSED;
+		budget.tick();
+	}
+	vector<long long> cursor(windowStart.begin(), windowStart.end()-1);
+	for (long long i=0; i<in.numTris; i+=1) {
+		const int* tri = tris + 3*i;
+		int w = grid.window(pos, tri, layout);
+		memcpy(sorted + 3*cursor[w], tri, 3*sizeof(int));
+		cursor[w] += 1;
+		for (int j=0; j<3; j+=1) {
+			int& t = tag[tri[j]];
+			if (t == UNUSED) t = w;
+			else if (t != w) t = SHARED;
+		}
+		budget.tick();
+	}
+	budget.release();
+
+	/** Simplify one window at a time, appending finished geometry **/
+	for (int w=0; w<numWindows; w+=1) {
+		if (grid.count[w] == 0) continue;
+		const int* wf = sorted + 3*windowStart[w];
+		int n = grid.count[w];
+
+		vector<int> globalIds(wf, wf + 3*n);
+		sort(globalIds.begin(), globalIds.end());
+		globalIds.erase(unique(globalIds.begin(), globalIds.end()), globalIds.end());
+
+		vector<vertex> vertices;
+		vertices.reserve(globalIds.size());
+		for (int i=0; i<globalIds.size(); i+=1) {
+			int g = globalIds[i];
+			vertex v(pos[3*g], pos[3*g+1], pos[3*g+2]);
+			v.position = (v.position - layout.middle) * layout.scale;
+			v.locked = tag[g] != w;
+			vertices.push_back(v);
+			budget.tick();
+		}
+		vector<vec3> faces(n);
+		for (int i=0; i<n; i+=1) {
+			for (int k=0; k<3; k+=1) {
+				faces[i][k] = lower_bound(globalIds.begin(), globalIds.end(), wf[3*i+k]) - globalIds.begin();
+			}
+		}
+		budget.release();
+		accumulateNormalsAndQuadrics(vertices, faces);
+
+		Mesh mesh(vertices, faces, 1, opts.precision);
+		mesh.lazy = opts.lazy;
+		/* Stops early once only locked or costly edges are left */
+		int target = (int)ceil(n*ratio);
+		if (opts.sample > 0) {
+			mesh.simplify_sampled(target, opts.sample, opts.seed + ((unsigned long long)pass << 32) + w);
+		} else {
+			mesh.simplify(target);
+		}
+
+		vector<int> outId(mesh.verts.size(), -1);
+		for (int i=0; i<mesh.edges.size(); i+=3) {
+			if (mesh.removed[i/3]) continue;
+			int tri[3] = {mesh.edges[i].v, mesh.edges[i+1].v, mesh.edges[i+2].v};
+			if (tri[0] == tri[1] || tri[1] == tri[2] || tri[2] == tri[0]) continue;
+			for (int k=0; k<3; k+=1) {
+				int l = tri[k];
+				if (outId[l] < 0) {
+					float xyz[3];
+					if (l < globalIds.size() && tag[globalIds[l]] <= EMITTED) {
+						outId[l] = EMITTED - tag[globalIds[l]];
+					} else {
+						if (l < globalIds.size()) {
+							memcpy(xyz, pos + 3*globalIds[l], sizeof(xyz));
+							if (tag[globalIds[l]] == SHARED) {
+								tag[globalIds[l]] = EMITTED - out.numVerts;
+							}
+						} else {
+							vec3 v = mesh.verts[l].position/layout.scale + layout.middle;
+							memcpy(xyz, &v[0], sizeof(xyz));
+						}
+						if (!out.verts.write(xyz, sizeof(xyz))) {
+							cout << "Unable to write scratch files next to " << tmp << endl;
+							return false;
+						}
+						outId[l] = out.numVerts++;
+					}
+				}
+				tri[k] = outId[l];
+			}
+			if (!out.tris.write(tri, sizeof(tri))) {
+				cout << "Unable to write scratch files next to " << tmp << endl;
+				return false;
+			}
+			out.numTris += 1;
+			budget.tick();
+		}
+		budget.release();
+#ifdef __GLIBC__
+		/* Hands the window's freed heap back, so the next one does not
+		 * grow the heap around its holes */
+		malloc_trim(0);
+#endif
+		cout << "Pass " << pass+1 << ", window " << w+1 << "/" << numWindows << ": " << n << " -> "
+			 << mesh.face_count() << " faces" << endl;
+	}
+	budget.ranges.clear();
+	if (!out.map()) {
+		cout << "Unable to map scratch files next to " << tmp << endl;
+		return false;
+	}
+	return true;
+}
+
+bool
+streamSimplify(const char* input, const char* output, const stream_options& opts) {
+	double start = wall_time();
+	double baseline = peak_memory_mb();
+	string tmp = string(output) + ".tmp";
+	page_budget budget(opts.memory_bytes / PAGE_SHARE);
+
+	/** Copy the input to scratch files and find its bounds **/
+	stream_mesh meshes[2];
+	vec3 lo, hi;
+	if (!read_input(input, tmp, budget, meshes[0], lo, hi)) {
+		return false;
+	}
+	long long numTris = meshes[0].numTris;
+
+	/* Same normalisation as prepareMesh, so costs match the viewer */
+	vec3 extent = hi-lo;
+	window_layout layout;
+	layout.middle = (lo+hi)/2.0f;
+	layout.scale = 8.0/max(max(extent.x, extent.y), extent.z);
+	int longest = (extent.x >= extent.y && extent.x >= extent.z) ? 0 : (extent.y >= extent.z ? 1 : 2);
+	int a = (longest+1)%3, b = (longest+2)%3;
+	layout.axis[0] = longest;
+	layout.axis[1] = extent[a] >= extent[b] ? a : b;
+	for (int k=0; k<2; k+=1) {
+		layout.lo[k] = lo[layout.axis[k]];
+		layout.extent[k] = extent[layout.axis[k]];
+	}
+
+	/** Sweep the windows until the target is met **/
+	size_t faceBytes = BYTES_PER_FACE;
+	if (opts.precision == DOUBLE_QUADRICS) {
+		faceBytes += DOUBLE_BYTES_PER_FACE;
+	}
+	size_t windowBytes = opts.memory_bytes - opts.memory_bytes/PAGE_SHARE;
+	long long windowFaces = max<long long>(1024, windowBytes / faceBytes);
+	long long target = (long long)ceil(numTris*opts.ratio);
+	long long slack = 0;
+	int cur = 0, passes = 0, windows = 0;
+	vector<int> cutsA(BINS+1), cutsB(ROW_BINS+1);
+	for (int k=0; k<=BINS; k+=1) {
+		cutsA[k] = k;
+	}
+	for (int k=0; k<=ROW_BINS; k+=1) {
+		cutsB[k] = k;
+	}
+	while (passes < MAX_PASSES) {
+		stream_mesh& src = meshes[cur];
+		stream_mesh& dst = meshes[1-cur];
+		window_grid grid;
+		plan_windows(src, layout, cutsA, cutsB, windowFaces, budget, grid);
+		int used = grid.count.size() - count(grid.count.begin(), grid.count.end(), 0LL);
+		/* The first sweep stops at twice the target, so the later ones
+		 * have collapses left to spend on the seams it kept */
+		long long goal = (passes == 0 && used > 1) ? 2*target : target;
+		double ratio = min(1.0, (double)goal/max(src.numTris, 1LL));
+		if (!simplify_windows(src, layout, grid, ratio, passes, opts, tmp, budget, dst)) {
+			return false;
+		}
+		src.close();
+		cur = 1-cur;
+		passes += 1;
+		windows += used;
+		/* Each window rounds its share of the target up */
+		slack = used;
+		if (dst.numTris <= target + slack || (passes > 1 && dst.numTris > src.numTris*0.99)) break;
+		cutsA = shifted_cuts(grid.firstBin);
+		cutsB = shifted_cuts(grid.firstRow);
+	}
+	const stream_mesh& result = meshes[cur];
+
+	/** Write the OFF file from the finished geometry **/
+	FILE* out = fopen(output, "w");
+	if (!out) {
+		cout << "Unable to open file " << output << endl;
+		return false;
+	}
+	budget.ranges.clear();
+	budget.watch(result.verts.data, result.verts.size);
+	budget.watch(result.tris.data, result.tris.size);
+	fprintf(out, "OFF\n%d %lld 0\n", result.numVerts, result.numTris);
+	const float* xyz = result.pos();
+	for (int i=0; i<result.numVerts; i+=1) {
+		fprintf(out, "%.9g %.9g %.9g\n", xyz[3*i], xyz[3*i+1], xyz[3*i+2]);
+		budget.tick();
+	}
+	const int* tri = result.tri();
+	for (long long i=0; i<result.numTris; i+=1) {
+		fprintf(out, "3 %d %d %d\n", tri[3*i], tri[3*i+1], tri[3*i+2]);
+		budget.tick();
+	}
+	bool ok = !ferror(out);
+	ok = fclose(out) == 0 && ok;
+	if (!ok) {
+		cout << "Unable to write " << output << endl;
+		return false;
+	}
+
+	double used = peak_memory_mb() - baseline;
+	bool missed = result.numTris > target + slack;
+	if (missed) {
+		cout << "Missed the target of " << target << " faces: " << numTris << " -> "
+			 << result.numTris << " faces in " << passes << (passes == 1 ? " pass" : " passes") << endl;
+	} else {
+		cout << "Simplified " << numTris << " -> " << result.numTris << " faces in " << passes
+			 << (passes == 1 ? " pass" : " passes") << " over " << windows << " windows, "
+			 << wall_time()-start << " s" << endl;
+	}
+	cout << "Peak memory " << used << " MB over the " << baseline << " MB at start, budget "
+		 << opts.memory_bytes/1048576.0 << " MB" << endl;
+	if (used > opts.memory_bytes/1048576.0) {
+		cout << "Exceeded the memory budget" << endl;
+		return false;
+	}
+	return !missed;
+}
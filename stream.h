@@ -0,0 +1,28 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <cstddef>
+#include "mesh.h"
+
+/********* Out-of-core streaming simplification ***********/
+
+struct stream_options {
+	double ratio;        // fraction of the faces to keep
+	size_t memory_bytes; // budget for the mesh window resident at once
+	quadric_precision precision;
+	bool lazy;           // see Mesh::lazy
+	int sample;          // edges drawn per collapse, see Mesh::simplify_sampled; 0 for the queue
+	unsigned long long seed;
+	stream_options();
+};
+
+/* Simplifies an OFF file of any size within a fixed memory budget. The
+ * faces are binned into windows on a grid over the two longest axes so
+ * each window fits the budget; windows are simplified one at a time
+ * with the quadric metric while the vertices they share stay locked, and
+ * their results are written back to disk. Passes over windows shifted
+ * by half a window simplify the seams, until the target is met. Returns
+ * false on errors, a missed target or a peak over the budget. */
+bool streamSimplify(const char* input, const char* output, const stream_options& opts);
+
+#endif //STREAM_H
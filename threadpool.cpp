@@ -0,0 +1,100 @@
+#include "threadpool.h"
+
+using namespace std;
+
+thread_pool::thread_pool(int threads)
+	: job(NULL), num_tasks(0), next_task(0), active(0), generation(0), stopping(false) {
+	for (int i=1; i<threads; i+=1) {
+		workers.push_back(thread(&thread_pool::work, this));
+	}
+}
+
+thread_pool::~thread_pool() {
+	{
+		unique_lock<mutex> guard(lock);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (int i=0; i<workers.size(); i+=1) {
+		workers[i].join();
+	}
+}
+
+int
+thread_pool::size() const {
+	return workers.size()+1;
+}
+
+/* Takes tasks until none are left */
+void
+thread_pool::drain() {
+	while (true) {
+		int task = next_task.fetch_add(1);
+		if (task >= num_tasks) return;
+		(*job)(task);
+	}
+}
+
+void
+thread_pool::work() {
+	unsigned seen = 0;
+	while (true) {
+		{
+			unique_lock<mutex> guard(lock);
+			while (!stopping && generation == seen) {
+				wake.wait(guard);
+			}
+			if (stopping) return;
+			seen = generation;
+		}
+		drain();
+		{
+			unique_lock<mutex> guard(lock);
+			active -= 1;
+			if (active == 0) finished.notify_all();
+		}
+	}
+}
+
+void
+thread_pool::run(int tasks, const function<void(int)>& fn) {
+	if (workers.empty() || tasks <= 1) {
+		for (int i=0; i<tasks; i+=1) fn(i);
+		return;
+	}
+	{
+		unique_lock<mutex> guard(lock);
+		job = &fn;
+		num_tasks = tasks;
+		next_task = 0;
+		active = workers.size();
+		generation += 1;
+	}
+	wake.notify_all();
+	drain();
+	unique_lock<mutex> guard(lock);
+	while (active > 0) {
+		finished.wait(guard);
+	}
+	job = NULL;
+}
+
+int
+hardware_threads() {
+	int n = thread::hardware_concurrency();
+	return n > 0 ? n : 1;
+}
+
+void
+parallel_for(int threads, int tasks, const function<void(int)>& fn) {
+	static thread_pool* pool = NULL;
+	if (threads <= 1 || tasks <= 1) {
+		for (int i=0; i<tasks; i+=1) fn(i);
+		return;
+	}
+	if (!pool || pool->size() != threads) {
+		delete pool;
+		pool = new thread_pool(threads);
+	}
+	pool->run(tasks, fn);
+}
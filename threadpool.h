@@ -0,0 +1,41 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <condition_variable>
+
+/********* Fixed size pool of worker threads ***********/
+
+class thread_pool {
+	std::vector<std::thread> workers;
+	std::mutex lock;
+	std::condition_variable wake;
+	std::condition_variable finished;
+	const std::function<void(int)>* job;
+	int num_tasks;
+	std::atomic<int> next_task;
+	int active;
+	unsigned generation;
+	bool stopping;
+	void work();
+	void drain();
+  public:
+	thread_pool(int threads);
+	~thread_pool();
+	int size() const;
+	/* Calls fn(0) .. fn(tasks-1) across the pool and the calling thread,
+	 * returning once every task has finished */
+	void run(int tasks, const std::function<void(int)>& fn);
+};
+
+/* Number of hardware threads, at least 1 */
+int hardware_threads();
+
+/* Runs fn(0) .. fn(tasks-1) on a shared pool of [threads] threads */
+void parallel_for(int threads, int tasks, const std::function<void(int)>& fn);
+
+#endif //THREADPOOL_H
@@ -0,0 +1,14 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <sys/time.h>
+
+/* Wall clock time in seconds, for reporting load and simplification times */
+inline double
+wall_time() {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec*1e-6;
+}
+
+#endif //TIMER_H